@@ -65,6 +65,10 @@ static bool has_infile = false;
 static cmd_func_t quit_helpers[MAXQUIT];
 static int quit_helper_cnt = 0;
 
+/* Optional function measuring overhead of timed commands */
+static timer_func_t time_helper = NULL;
+static cmd_func_t cmd_helper = NULL;
+
 static void init_in();
 
 static bool push_file(char *fname);
@@ -214,6 +218,8 @@ static bool interpret_cmda(int argc, char *argv[])
         ok = next_cmd->operation(argc, argv);
         if (!ok)
             record_error();
+        if (cmd_helper)
+            cmd_helper(argc, argv);
     } else {
         report(1, "Unknown command '%s'", argv[0]);
         record_error();
@@ -239,6 +245,18 @@ static bool interpret_cmd(char *cmdline)
     return ok;
 }
 
+/* Set function measuring overhead of timed commands */
+void set_time_helper(timer_func_t tf)
+{
+    time_helper = tf;
+}
+
+/* Set function called once every command ran */
+void set_cmd_helper(cmd_func_t hf)
+{
+    cmd_helper = hf;
+}
+
 /* Set function to be executed as part of program exit */
 void add_quit_helper(cmd_func_t qf)
 {
@@ -390,12 +408,19 @@ static bool do_time(int argc, char *argv[])
         double elapsed = last_time - first_time;
         report(1, "Elapsed time = %.3f, Delta time = %.3f", elapsed, delta);
     } else {
+        if (time_helper)
+            time_helper(true);
         ok = interpret_cmda(argc - 1, argv + 1);
+        double overhead = time_helper ? time_helper(false) : 0;
         if (block_flag) {
             block_timing = true;
         } else {
             delta = delta_time(&last_time);
-            report(1, "Delta time = %.3f", delta);
+            if (time_helper)
+                report(1, "Delta time = %.3f, harness time = %.3f", delta,
+                       overhead);
+            else
+                report(1, "Delta time = %.3f", delta);
         }
     }
 
@@ -56,6 +56,19 @@ bool get_int(char *vname, int *loc);
 /* Add function to be executed as part of program exit */
 void add_quit_helper(cmd_func_t qf);
 
+/* Function measuring part of the time of a command, started with true before
+ * it and stopped with false after it, then returning seconds
+ */
+typedef double (*timer_func_t)(bool start);
+
+/* Add function reporting, for the 'time' command, how much of the time was
+ * spent outside the code under test
+ */
+void set_time_helper(timer_func_t tf);
+
+/* Add function called with the arguments of every command it ran */
+void set_cmd_helper(cmd_func_t hf);
+
 /* Turn echoing on/off */
 void set_echo(bool on);
 
@@ -4,6 +4,8 @@
 
 #include "constant.h"
 #include "cpucycles.h"
+/* For the arena of the harness */
+#define INTERNAL 1
 #include "queue.h"
 #include "random.h"
 
@@ -12,7 +14,20 @@
  */
 static struct list_head *l = NULL;
 
-#define dut_new() ((void) (l = q_new()))
+/* Every queue is built with the allocator qtest is set to. In arena mode,
+ * it lies above whatever qtest already keeps in the arena, and is dropped at
+ * once instead of freed node by node.
+ */
+static size_t arena_mark;
+static int arena_saved;
+
+static void dut_new(void)
+{
+    arena_saved = arena_mode;
+    if (arena_saved)
+        arena_mark = harness_mark();
+    l = q_new();
+}
 
 #define dut_size(n)                                \
     do {                                           \
@@ -34,7 +49,15 @@ static struct list_head *l = NULL;
             q_insert_tail(l, s); \
     } while (0)
 
-#define dut_free() ((void) (q_free(l)))
+static void dut_free(void)
+{
+    if (arena_saved)
+        harness_reset(arena_mark);
+    else
+        q_free(l);
+    arena_mode = arena_saved;
+    l = NULL;
+}
 
 static char random_string[N_MEASURES][8];
 static int random_string_iter = 0;
@@ -1,11 +1,18 @@
 /* Test support code */
 
+#include <assert.h>
+#include <pthread.h>
 #include <setjmp.h>
 #include <signal.h>
+#include <stdalign.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "report.h"
@@ -19,6 +26,9 @@
 /* Value at start of every allocated block */
 #define MAGICHEADER 0xdeadbeef
 
+/* Value at start of every block allocated in arena mode */
+#define MAGICARENA 0xdeadface
+
 /* Value when deallocate block */
 #define MAGICFREE 0xffffffff
 
@@ -28,36 +38,177 @@
 /* Byte to fill newly malloced space with */
 #define FILLCHAR 0x55
 
+/* Byte to fill the padding between a guarded payload and its guard page */
+#define PADCHAR 0xaa
+
 /* Data structures used by our code */
 
-/* Represent allocated blocks as doubly-linked list, with
- * next and prev pointers at beginning
- */
+/* Header of every allocated block */
 typedef struct __block_element {
-    struct __block_element *next, *prev;
     size_t payload_size;
-    size_t magic_header; /* Marker to see if block seems legitimate */
+    uint32_t magic_header; /* Marker to see if block seems legitimate */
+    uint32_t heap_id : 31; /* Heap of the thread which allocated it */
+    uint32_t guarded : 1;  /* Whether followed by a guard page */
     unsigned char payload[0];
     /* Also place magic number at tail of every block */
 } block_element_t;
 
-static block_element_t *allocated = NULL;
-static size_t allocated_count = 0;
+/* Every thread keeps the blocks it allocated in a heap of its own, an
+ * open-addressing hash set with linear probing, so checking that a block is
+ * allocated takes O(1) time. The table is never more than half full, and
+ * removal shifts back the entries of the probe sequence instead of leaving
+ * tombstones.
+ *
+ * A block freed by another thread is checked and poisoned by that thread,
+ * then pushed without locking on the remote stack of its heap, linked
+ * through its footer. The owner drains the stack on its next allocation or
+ * free. The heap of an exited thread is adopted by the next new thread.
+ *
+ * In arena mode, blocks are carved one after another from large chunks of
+ * the heap instead, and stay out of the table. Freeing them only poisons
+ * them, and harness_reset() drops all those carved since a mark at once.
+ * Their memory is never reused before, so a double free is always caught.
+ *
+ * With a quarantine, the other blocks freed are not given back to malloc at
+ * once but poisoned and queued in a ring of the heap of their owner. They
+ * are checked to be still poisoned when they leave the ring or it is flushed,
+ * and a slice at a time by error_check(), which catches writes made after a
+ * free.
+ *
+ * A block of at least guard_size bytes is mapped on pages of its own instead,
+ * its payload ending where an inaccessible page starts, so that overrunning
+ * it faults at once. Its footer moves in front of the header. The payload
+ * stays aligned as malloc() would align it, so up to GUARD_ALIGN - 1 bytes
+ * of padding may separate it from the guard page. Overruns into them do not
+ * fault, but the padding is checked when the block is freed.
+ */
+#define MIN_TABLE_BITS 10
+
+/* Alignment of guarded payloads, as malloc() aligns its blocks */
+#define GUARD_ALIGN alignof(max_align_t)
+#define GUARD_ROUND(n) (((n) + GUARD_ALIGN - 1) & ~(GUARD_ALIGN - 1))
+#define MAX_HEAPS 1024
+
+/* Quarantined blocks checked by every error_check() */
+#define QUARANTINE_SLICE 256
+
+/* Call sites profiled by every thread, beyond which they are lumped */
+#define SITE_BITS 8
+#define SITE_SLOTS (1 << SITE_BITS)
+#define SITE_MAX (SITE_SLOTS * 3 / 4)
+
+/* Chunks are mapped in multiples of the huge page size */
+#define ARENA_CHUNK_SIZE ((size_t) 2 << 20)
+#define ARENA_ALIGN(n) (((n) + 15) & ~(size_t) 15)
+
+typedef struct __arena_chunk {
+    struct __arena_chunk *prev; /* Chunk carved before this one */
+    size_t start;               /* Arena position of data */
+    size_t size, used;          /* Bytes of data */
+    unsigned char data[] __attribute__((aligned(16)));
+} arena_chunk_t;
+
+typedef struct {
+    block_element_t **table;
+    int bits;
+    uint32_t id;
+    size_t count; /* Blocks in table, read by allocation_check() */
+    block_element_t *remote; /* Blocks freed by other threads */
+    size_t remote_count;     /* Blocks in remote */
+    bool orphan;             /* Owner has exited, guarded by heaps_lock */
+    arena_chunk_t *arena;    /* Chunk being carved */
+    size_t arena_count;      /* Arena blocks carved and not freed by owner */
+    size_t arena_remote;     /* Arena blocks freed by other threads */
+    block_element_t **quarantine; /* Ring of freed blocks, oldest first */
+    size_t quarantine_cap, quarantine_head, quarantine_count;
+    size_t quarantine_cursor; /* Offset from head of the next block checked */
+
+    /* Profile of the calls made by the owner, see harness_stats() */
+    size_t allocs, frees;
+    size_t size_classes[HARNESS_SIZE_CLASSES];
+    harness_site_t sites[SITE_SLOTS + 1]; /* Last one for the overflow */
+    size_t site_count;
+} block_heap_t;
+
+/* Every heap created, indexed by id */
+static block_heap_t *heaps[MAX_HEAPS];
+static uint32_t heap_count = 0;
+static pthread_mutex_t heaps_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t heap_key;
+static pthread_once_t heap_key_once = PTHREAD_ONCE_INIT;
 
-/* Percent probability of malloc failure */
+static __thread block_heap_t *my_heap = NULL;
+
+/* Fault injection schedules, see reset_fault_injection() */
 int fail_probability = 0;
+int fail_seed = 1;
+int fail_every = 0;
+int fail_first = 0, fail_last = 0;
+
+/* Whether any schedule is set, the only test made when none is */
+static bool fault_armed = false;
+/* fail_probability scaled to the 32-bit output of the generator */
+static uint64_t fault_threshold;
+/* Bumped by every reset, restarting the state of each thread */
+static unsigned fault_generation = 0;
+static __thread unsigned my_fault_generation = 0;
+static __thread uint64_t fault_rng;
+static __thread unsigned long fault_count;
+
+/* Carve blocks from arena chunks, backed by huge pages if 2 */
+int arena_mode = 0;
+
+/* Payload bytes allocated by all threads, and their peak since reset */
+static size_t live_bytes = 0;
+static size_t peak_bytes = 0;
+
+/* Map payloads of guard_size bytes or more before a guard page, none if 0 */
+int guard_size = 0;
+
+/* Hold up to quarantine_size freed blocks in every heap, none if 0 */
+int quarantine_size = 0;
+
+/* Fill and poison the payload of one block in every poison_interval */
+int poison_interval = 1;
+static __thread unsigned long fill_count = 0, poison_count = 0;
+
+/* Time spent in the harness by each thread while timing is on, estimated
+ * from one call in every TIMING_INTERVAL since reading the clock costs as
+ * much as a malloc
+ */
+#define TIMING_INTERVAL 15
+static bool harness_timing = false;
+static __thread double harness_seconds = 0;
+static __thread unsigned long timing_count = 0;
+
+/* Time of the rare costly work, such as growing tables, counted in full */
+static __thread double rare_seconds = 0;
 
 static bool cautious_mode = true;
 static bool noallocate_mode = false;
 static bool error_occurred = false;
-static char *error_message = "";
+static __thread char *error_message = "";
 
-static int time_limit = 1;
+/* Milliseconds guarded code may run, without limit if 0 */
+int time_limit_ms = 1000;
 
-/* Data for managing exceptions */
-static jmp_buf env;
-static volatile sig_atomic_t jmp_ready = false;
-static bool time_limited = false;
+/* The only thread allowed a time limit, since the timer and SIGALRM are
+ * shared by the whole process
+ */
+static pthread_t main_thread;
+
+static void __attribute__((constructor)) main_thread_init()
+{
+    main_thread = pthread_self();
+}
+
+/* Data for managing exceptions, for each thread */
+static __thread jmp_buf env;
+static __thread volatile sig_atomic_t jmp_ready = false;
+static __thread bool time_limited = false;
+static __thread double guard_start;
+static __thread double guard_seconds = 0;
+static __thread size_t guard_count = 0;
 
 /* For test_malloc and test_calloc */
 typedef enum {
@@ -67,62 +218,593 @@ typedef enum {
 
 /* Internal functions */
 
-/* Should this allocation fail? */
-static bool fail_allocation()
+static void set_error()
 {
-    double weight = (double) random() / RAND_MAX;
-    return (weight < 0.01 * fail_probability);
+    __atomic_store_n(&error_occurred, true, __ATOMIC_RELAXED);
 }
 
-/* Find header of block, given its payload.
- * Signal error if doesn't seem like legitimate block
- */
-static block_element_t *find_header(void *p)
+static double harness_clock()
 {
-    if (!p) {
-        report_event(MSG_ERROR, "Attempting to free null block");
-        error_occurred = true;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1.0E-9 * ts.tv_nsec;
+}
+
+/* Cost of reading the clock, taken out of every timed call */
+static double clock_overhead = -1;
+
+static void calibrate_clock()
+{
+    clock_overhead = 1;
+    for (int i = 0; i < 1000; i++) {
+        double t = harness_clock();
+        t = harness_clock() - t;
+        if (t < clock_overhead)
+            clock_overhead = t;
     }
+}
 
-    block_element_t *b =
-        (block_element_t *) ((size_t) p - sizeof(block_element_t));
-    if (cautious_mode) {
-        /* Make sure this is really an allocated block */
-        block_element_t *ab = allocated;
-        bool found = false;
-        while (ab && !found) {
-            found = ab == b;
-            ab = ab->next;
-        }
-        if (!found) {
-            report_event(MSG_ERROR,
-                         "Attempted to free unallocated block.  Address = %p",
-                         p);
-            error_occurred = true;
+/* Should this call be timed? */
+static inline bool timed_call()
+{
+    return harness_timing && timing_count++ % TIMING_INTERVAL == 0;
+}
+
+/* Account a timed call begun at start, when rare_seconds was rare */
+static void sample_time(double start, double rare)
+{
+    double t = harness_clock() - start - clock_overhead;
+    harness_seconds += (t - (rare_seconds - rare)) * TIMING_INTERVAL;
+}
+
+/* Count a block, telling whether it is one of those filled or poisoned */
+static bool sample_block(unsigned long *counter)
+{
+    return poison_interval > 0 && (*counter)++ % poison_interval == 0;
+}
+
+/* Should this allocation fail? Only called once fault_armed is set. */
+static bool fail_allocation(uint32_t heap_id)
+{
+    unsigned gen = __atomic_load_n(&fault_generation, __ATOMIC_ACQUIRE);
+    if (my_fault_generation != gen) {
+        my_fault_generation = gen;
+        /* Threads other than the first get streams of their own */
+        fault_rng = (uint32_t) fail_seed ^
+                    ((uint64_t) heap_id << 32 | 0x9e3779b9U);
+        fault_count = 0;
+    }
+
+    unsigned long n = ++fault_count;
+    if (fail_every > 0 && n % fail_every == 0)
+        return true;
+    if (fail_first > 0 && n >= (unsigned long) fail_first &&
+        (fail_last <= 0 || n <= (unsigned long) fail_last))
+        return true;
+    if (!fault_threshold)
+        return false;
+
+    fault_rng ^= fault_rng << 13;
+    fault_rng ^= fault_rng >> 7;
+    fault_rng ^= fault_rng << 17;
+    return (fault_rng >> 32) < fault_threshold;
+}
+
+/* Apply the fault injection schedules, restarting them */
+void reset_fault_injection()
+{
+    int p = fail_probability < 0 ? 0 : fail_probability;
+    fault_threshold = p >= 100 ? UINT64_C(1) << 32
+                               : ((UINT64_C(1) << 32) * p + 99) / 100;
+    fault_armed = fault_threshold || fail_every > 0 || fail_first > 0;
+    __atomic_add_fetch(&fault_generation, 1, __ATOMIC_RELEASE);
+}
+
+/* Home slot of block b in a table of 2^bits slots. The address bits are
+ * folded rather than scrambled, so that blocks allocated one after another
+ * land in nearby slots and stay cache friendly.
+ */
+static inline size_t block_hash(const block_element_t *b, int bits)
+{
+    uintptr_t a = (uintptr_t) b >> 4;
+    return (size_t) ((a ^ (a >> bits)) & (((size_t) 1 << bits) - 1));
+}
+
+/* Slot where block b is, or would be inserted */
+static size_t block_slot(block_element_t *const *table,
+                         int bits,
+                         const block_element_t *b)
+{
+    size_t mask = ((size_t) 1 << bits) - 1;
+    size_t i = block_hash(b, bits);
+    while (table[i] && table[i] != b)
+        i = (i + 1) & mask;
+    return i;
+}
+
+/* Double the table of heap h, or create it */
+static bool block_table_grow(block_heap_t *h)
+{
+    int bits = h->table ? h->bits + 1 : MIN_TABLE_BITS;
+    block_element_t **table = calloc((size_t) 1 << bits, sizeof(*table));
+    if (!table)
+        return false;
+
+    if (h->table) {
+        for (size_t i = 0; i < (size_t) 1 << h->bits; i++) {
+            if (h->table[i])
+                table[block_slot(table, bits, h->table[i])] = h->table[i];
         }
+        free(h->table);
     }
+    h->table = table;
+    h->bits = bits;
+    return true;
+}
 
-    if (b->magic_header != MAGICHEADER) {
-        report_event(
-            MSG_ERROR,
-            "Attempted to free unallocated or corrupted block.  Address = %p",
-            p);
-        error_occurred = true;
+static bool block_add(block_heap_t *h, block_element_t *b)
+{
+    if (!h->table || h->count >= (size_t) 1 << (h->bits - 1)) {
+        double start = harness_timing ? harness_clock() : 0;
+        bool ok = block_table_grow(h);
+        if (harness_timing) {
+            double t = harness_clock() - start;
+            rare_seconds += t;
+            harness_seconds += t;
+        }
+        if (!ok)
+            return false;
     }
+    h->table[block_slot(h->table, h->bits, b)] = b;
+    __atomic_store_n(&h->count, h->count + 1, __ATOMIC_RELAXED);
+    return true;
+}
 
-    return b;
+static bool block_contains(const block_heap_t *h, const block_element_t *b)
+{
+    return h->table && h->table[block_slot(h->table, h->bits, b)];
+}
+
+/* Remove block b if present, moving back the entries after it which could
+ * no longer be reached from their home slot.
+ */
+static bool block_remove(block_heap_t *h, const block_element_t *b)
+{
+    if (!h->table)
+        return false;
+
+    block_element_t **table = h->table;
+    size_t mask = ((size_t) 1 << h->bits) - 1;
+    size_t hole = block_slot(table, h->bits, b);
+    if (!table[hole])
+        return false;
+
+    table[hole] = NULL;
+    __atomic_store_n(&h->count, h->count - 1, __ATOMIC_RELAXED);
+    for (size_t i = (hole + 1) & mask; table[i]; i = (i + 1) & mask) {
+        size_t home = block_hash(table[i], h->bits);
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            table[hole] = table[i];
+            table[i] = NULL;
+            hole = i;
+        }
+    }
+    return true;
 }
 
 /* Given pointer to block, find its footer */
 static size_t *find_footer(block_element_t *b)
 {
+    if (b->guarded)
+        return (size_t *) b - 1;
     // cppcheck-suppress nullPointerRedundantCheck
     size_t *p =
         (size_t *) ((size_t) b + b->payload_size + sizeof(block_element_t));
     return p;
 }
 
-static void *alloc(alloc_t alloc_type, size_t size)
+/* Bytes mapped for a guarded block of size bytes, guard page excluded */
+static size_t guard_span(size_t size, size_t page)
+{
+    size_t need = sizeof(size_t) + sizeof(block_element_t) + GUARD_ROUND(size);
+    return (need + page - 1) & ~(page - 1);
+}
+
+/* Map a block of size bytes whose aligned payload ends at an inaccessible
+ * page, but for the padding
+ */
+static block_element_t *guard_alloc(size_t size)
+{
+    size_t page = sysconf(_SC_PAGESIZE), span = guard_span(size, page);
+    unsigned char *map = mmap(NULL, span + page, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+        return NULL;
+    if (mprotect(map + span, page, PROT_NONE)) {
+        munmap(map, span + page);
+        return NULL;
+    }
+    memset(map + span - GUARD_ROUND(size) + size, PADCHAR,
+           GUARD_ROUND(size) - size);
+    return (block_element_t *) (map + span - GUARD_ROUND(size) -
+                                sizeof(block_element_t));
+}
+
+/* Is the padding between the payload of guarded block b and its guard page
+ * as guard_alloc() left it?
+ */
+static bool guard_pad_intact(const block_element_t *b)
+{
+    for (size_t i = b->payload_size; i < GUARD_ROUND(b->payload_size); i++) {
+        if (b->payload[i] != PADCHAR)
+            return false;
+    }
+    return true;
+}
+
+/* Give back the memory of block b */
+static void block_free(block_element_t *b)
+{
+    if (!b->guarded) {
+        free(b);
+        return;
+    }
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t span = guard_span(b->payload_size, page);
+    munmap(&b->payload[GUARD_ROUND(b->payload_size)] - span, span + page);
+}
+
+/* Is freed block b still poisoned? Report it if not. */
+static bool quarantine_intact(block_element_t *b)
+{
+    const unsigned char *p = b->payload;
+    size_t n = b->payload_size;
+    if (b->magic_header == MAGICFREE && *find_footer(b) == MAGICFREE &&
+        (!n || (p[0] == FILLCHAR && !memcmp(p, p + 1, n - 1))))
+        return true;
+
+    report_event(MSG_ERROR, "Use after free detected in block with address %p",
+                 (void *) p);
+    set_error();
+    return false;
+}
+
+/* Check that freed block b is still poisoned, then give it back */
+static void quarantine_release(block_element_t *b)
+{
+    quarantine_intact(b);
+    block_free(b);
+}
+
+/* Release every block in the quarantine of heap h */
+static void quarantine_flush(block_heap_t *h)
+{
+    for (; h->quarantine_count; h->quarantine_count--) {
+        quarantine_release(h->quarantine[h->quarantine_head]);
+        h->quarantine_head = (h->quarantine_head + 1) % h->quarantine_cap;
+    }
+    h->quarantine_head = 0;
+}
+
+/* Queue freed block b of heap h, releasing the oldest one if full */
+static void quarantine_push(block_heap_t *h, block_element_t *b)
+{
+    size_t cap = quarantine_size > 0 ? quarantine_size : 0;
+    if (h->quarantine_cap != cap) {
+        quarantine_flush(h);
+        free(h->quarantine);
+        h->quarantine = cap ? malloc(cap * sizeof(*h->quarantine)) : NULL;
+        h->quarantine_cap = h->quarantine ? cap : 0;
+    }
+    if (!h->quarantine_cap) {
+        block_free(b);
+        return;
+    }
+
+    size_t i = (h->quarantine_head + h->quarantine_count) % h->quarantine_cap;
+    if (h->quarantine_count == h->quarantine_cap) {
+        quarantine_release(h->quarantine[i]);
+        h->quarantine_head = (i + 1) % h->quarantine_cap;
+    } else {
+        h->quarantine_count++;
+    }
+    h->quarantine[i] = b;
+}
+
+/* Check that the next QUARANTINE_SLICE blocks in the quarantine of heap h
+ * are still poisoned, going round the ring over successive calls
+ */
+static void quarantine_check(block_heap_t *h)
+{
+    size_t n = h->quarantine_count, k = h->quarantine_cursor % n;
+    if (n > QUARANTINE_SLICE)
+        n = QUARANTINE_SLICE;
+    h->quarantine_cursor = (k + n) % h->quarantine_count;
+    for (; n--; k = (k + 1) % h->quarantine_count) {
+        block_element_t *b =
+            h->quarantine[(h->quarantine_head + k) % h->quarantine_cap];
+        if (!quarantine_intact(b)) {
+            /* Poison it again to report each write once */
+            b->magic_header = MAGICFREE;
+            memset(b->payload, FILLCHAR, b->payload_size);
+            *find_footer(b) = MAGICFREE;
+        }
+    }
+}
+
+/* Release the blocks other threads have freed from heap h */
+static void heap_drain(block_heap_t *h)
+{
+    block_element_t *b =
+        __atomic_exchange_n(&h->remote, NULL, __ATOMIC_ACQUIRE);
+    size_t n = 0;
+    for (block_element_t *next; b; b = next, n++) {
+        next = (block_element_t *) *find_footer(b);
+        if (block_remove(h, b)) {
+            *find_footer(b) = MAGICFREE;
+            quarantine_push(h, b);
+        } else {
+            report_event(MSG_ERROR,
+                         "Attempted to free unallocated block.  Address = %p",
+                         (void *) &b->payload);
+            set_error();
+        }
+    }
+    __atomic_sub_fetch(&h->remote_count, n, __ATOMIC_RELAXED);
+}
+
+/* Push freed block b on the remote stack of heap h */
+static void heap_push_remote(block_heap_t *h, block_element_t *b)
+{
+    block_element_t *top = __atomic_load_n(&h->remote, __ATOMIC_RELAXED);
+    do {
+        *find_footer(b) = (size_t) top;
+    } while (!__atomic_compare_exchange_n(&h->remote, &top, b, true,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    __atomic_add_fetch(&h->remote_count, 1, __ATOMIC_RELAXED);
+}
+
+/* Leave the heap of an exiting thread to be drained by allocation_check()
+ * and adopted by a new thread
+ */
+static void heap_exit(void *arg)
+{
+    block_heap_t *h = arg;
+    pthread_mutex_lock(&heaps_lock);
+    h->orphan = true;
+    pthread_mutex_unlock(&heaps_lock);
+}
+
+static void heap_key_create()
+{
+    if (pthread_key_create(&heap_key, heap_exit))
+        report_event(MSG_FATAL, "Couldn't create thread heap key");
+}
+
+static block_heap_t *heap_create()
+{
+    pthread_once(&heap_key_once, heap_key_create);
+
+    block_heap_t *h = NULL;
+    pthread_mutex_lock(&heaps_lock);
+    for (uint32_t i = 0; i < heap_count && !h; i++) {
+        if (heaps[i]->orphan)
+            h = heaps[i];
+    }
+    if (h) {
+        h->orphan = false;
+    } else if (heap_count < MAX_HEAPS &&
+               (h = calloc(1, sizeof(block_heap_t)))) {
+        h->id = heap_count;
+        __atomic_store_n(&heaps[h->id], h, __ATOMIC_RELEASE);
+        __atomic_store_n(&heap_count, heap_count + 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&heaps_lock);
+
+    if (!h) {
+        report_event(MSG_FATAL, "Couldn't create heap for another thread");
+        return NULL;
+    }
+    pthread_setspecific(heap_key, h);
+    my_heap = h;
+    return h;
+}
+
+/* Is b a block carved from the arena of heap h? */
+static bool arena_contains(const block_heap_t *h, const block_element_t *b)
+{
+    for (const arena_chunk_t *c = h->arena; c; c = c->prev) {
+        if ((const unsigned char *) b >= c->data &&
+            (const unsigned char *) b < c->data + c->used)
+            return true;
+    }
+    return false;
+}
+
+/* Add a chunk of at least need bytes on top of the arena of heap h */
+static bool arena_grow(block_heap_t *h, size_t need)
+{
+    arena_chunk_t *top = h->arena;
+    size_t size = top ? 2 * (top->size + sizeof(arena_chunk_t))
+                      : ARENA_CHUNK_SIZE;
+    while (size < need + sizeof(arena_chunk_t))
+        size *= 2;
+
+    /* Huge pages need chunks aligned to their size: map more, then trim */
+    size_t align = arena_mode == 2 ? ARENA_CHUNK_SIZE : 0;
+    char *map = mmap(NULL, size + align, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+        return false;
+    arena_chunk_t *c = (arena_chunk_t *) map;
+    if (align) {
+        size_t head = -(uintptr_t) map & (align - 1);
+        if (head)
+            munmap(map, head);
+        munmap(map + head + size, align - head);
+        c = (arena_chunk_t *) (map + head);
+#ifdef MADV_HUGEPAGE
+        madvise(c, size, MADV_HUGEPAGE);
+#endif
+    }
+    c->prev = top;
+    c->start = top ? top->start + top->size : 0;
+    c->size = size - sizeof(arena_chunk_t);
+    c->used = 0;
+    h->arena = c;
+    return true;
+}
+
+/* Carve a block of size bytes from the arena of heap h */
+static block_element_t *arena_alloc(block_heap_t *h, size_t size)
+{
+    size_t need = ARENA_ALIGN(sizeof(block_element_t) + size + sizeof(size_t));
+    arena_chunk_t *c = h->arena;
+    if (!c || c->size - c->used < need) {
+        double start = harness_timing ? harness_clock() : 0;
+        bool ok = arena_grow(h, need);
+        if (harness_timing) {
+            double t = harness_clock() - start;
+            rare_seconds += t;
+            harness_seconds += t;
+        }
+        if (!ok)
+            return NULL;
+        c = h->arena;
+    }
+    block_element_t *b = (block_element_t *) (c->data + c->used);
+    c->used += need;
+    return b;
+}
+
+/* Count the blocks still allocated in chunk c from offset from on, adding
+ * their payload bytes to bytes
+ */
+static size_t arena_count_live(arena_chunk_t *c, size_t from, size_t *bytes)
+{
+    size_t n = 0;
+    while (from < c->used) {
+        block_element_t *b = (block_element_t *) (c->data + from);
+        size_t len = ARENA_ALIGN(sizeof(block_element_t) + b->payload_size +
+                                 sizeof(size_t));
+        if (len > c->used - from) {
+            report_event(MSG_ERROR, "Corrupted block in arena.  Address = %p",
+                         (void *) &b->payload);
+            set_error();
+            break;
+        }
+        if (b->magic_header == MAGICARENA) {
+            n++;
+            *bytes += b->payload_size;
+        }
+        from += len;
+    }
+    return n;
+}
+
+/* Add n to a profile counter of the calling thread. Other threads read and
+ * clear the counters, so every access is atomic, but only the owner adds to
+ * them, which takes no read-modify-write.
+ */
+static inline void profile_add(size_t *counter, size_t n)
+{
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n,
+                     __ATOMIC_RELAXED);
+}
+
+/* Account an allocation of size bytes made from caller */
+static void profile_alloc(block_heap_t *h, size_t size, const void *caller)
+{
+    profile_add(&h->allocs, 1);
+    profile_add(&h->size_classes[size ? 63 - __builtin_clzl(size) : 0], 1);
+
+    size_t i = ((uintptr_t) caller * 0x9e3779b97f4a7c15ULL) >> (64 - SITE_BITS);
+    const void *site;
+    while ((site = __atomic_load_n(&h->sites[i].caller, __ATOMIC_RELAXED)) &&
+           site != caller)
+        i = (i + 1) & (SITE_SLOTS - 1);
+    if (!site) {
+        if (__atomic_load_n(&h->site_count, __ATOMIC_RELAXED) < SITE_MAX) {
+            __atomic_store_n(&h->sites[i].caller, caller, __ATOMIC_RELAXED);
+            profile_add(&h->site_count, 1);
+        } else {
+            i = SITE_SLOTS;
+        }
+    }
+    profile_add(&h->sites[i].allocs, 1);
+    profile_add(&h->sites[i].bytes, size);
+
+    size_t live = __atomic_add_fetch(&live_bytes, size, __ATOMIC_RELAXED);
+    size_t peak = __atomic_load_n(&peak_bytes, __ATOMIC_RELAXED);
+    while (live > peak &&
+           !__atomic_compare_exchange_n(&peak_bytes, &peak, live, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/* Get the heap of the calling thread, with frees from others released */
+static inline block_heap_t *heap_get()
+{
+    block_heap_t *h = my_heap ? my_heap : heap_create();
+    if (__atomic_load_n(&h->remote, __ATOMIC_RELAXED))
+        heap_drain(h);
+    return h;
+}
+
+/* Could b be a block of another thread? Only its owner can tell for sure */
+static bool remote_block_valid(const block_element_t *b)
+{
+    return (b->magic_header == MAGICHEADER ||
+            b->magic_header == MAGICARENA) &&
+           b->heap_id < __atomic_load_n(&heap_count, __ATOMIC_ACQUIRE);
+}
+
+/* Is the header of b mapped? Checked before reading the header of a block
+ * that the calling thread does not know of, which may be a guarded block
+ * already unmapped.
+ */
+static bool header_mapped(const block_element_t *b)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t) b & ~(page - 1);
+    unsigned char vec[2];
+    return !mincore((void *) start, (uintptr_t) (b + 1) - start, vec);
+}
+
+/* Find header of block, given its payload.
+ * Signal error and return NULL when it is known not to be allocated: by
+ * cautious mode for blocks of the calling thread, always for those of others.
+ */
+static block_element_t *find_header(block_heap_t *h, void *p)
+{
+    if (!p) {
+        report_event(MSG_ERROR, "Attempting to free null block");
+        set_error();
+    }
+
+    block_element_t *b =
+        (block_element_t *) ((size_t) p - sizeof(block_element_t));
+    /* Cautious mode looks blocks up by address before reading their header */
+    bool found =
+        cautious_mode && (block_contains(h, b) || arena_contains(h, b));
+    if (!found && (cautious_mode || b->heap_id != h->id)) {
+        /* Blocks of other threads are only looked up by their owner, when
+         * draining, so their header is all there is to check here.
+         */
+        found = (!cautious_mode || header_mapped(b)) &&
+                b->heap_id != h->id && remote_block_valid(b);
+        if (!found) {
+            report_event(MSG_ERROR,
+                         "Attempted to free unallocated block.  Address = %p",
+                         p);
+            set_error();
+            return NULL;
+        }
+    }
+    return b;
+}
+
+static void *alloc(alloc_t alloc_type, size_t size, const void *caller)
 {
     if (noallocate_mode) {
         char *msg_alloc_forbidden[] = {
@@ -133,7 +815,8 @@ static void *alloc(alloc_t alloc_type, size_t size)
         return NULL;
     }
 
-    if (fail_allocation()) {
+    block_heap_t *h = heap_get();
+    if (fault_armed && fail_allocation(h->id)) {
         char *msg_alloc_failure[] = {
             "Malloc returning NULL",
             "Calloc returning NULL",
@@ -142,38 +825,62 @@ static void *alloc(alloc_t alloc_type, size_t size)
         return NULL;
     }
 
-    block_element_t *new_block =
-        malloc(size + sizeof(block_element_t) + sizeof(size_t));
+    bool guarded = !arena_mode && guard_size > 0 && size >= (size_t) guard_size;
+    block_element_t *new_block = arena_mode ? arena_alloc(h, size)
+                                 : guarded  ? guard_alloc(size)
+                                            : NULL;
+    if (!new_block && !arena_mode) {
+        /* Also when out of mappings, of which guarded blocks take two */
+        guarded = false;
+        new_block = malloc(size + sizeof(block_element_t) + sizeof(size_t));
+    }
     if (!new_block) {
         report_event(MSG_FATAL, "Couldn't allocate any more memory");
-        error_occurred = true;
+        set_error();
     }
 
     // cppcheck-suppress nullPointerRedundantCheck
-    new_block->magic_header = MAGICHEADER;
+    new_block->heap_id = h->id;
+    new_block->guarded = guarded;
+    // cppcheck-suppress nullPointerRedundantCheck
+    new_block->magic_header = arena_mode ? MAGICARENA : MAGICHEADER;
     // cppcheck-suppress nullPointerRedundantCheck
     new_block->payload_size = size;
     *find_footer(new_block) = MAGICFOOTER;
     void *p = (void *) &new_block->payload;
-    memset(p, !alloc_type * FILLCHAR, size);
-    // cppcheck-suppress nullPointerRedundantCheck
-    new_block->next = allocated;
-    // cppcheck-suppress nullPointerRedundantCheck
-    new_block->prev = NULL;
-
-    if (allocated)
-        allocated->prev = new_block;
-    allocated = new_block;
-    allocated_count++;
+    if (alloc_type == TEST_CALLOC)
+        memset(p, 0, size);
+    else if (sample_block(&fill_count))
+        memset(p, FILLCHAR, size);
+    if (arena_mode) {
+        __atomic_store_n(&h->arena_count, h->arena_count + 1,
+                         __ATOMIC_RELAXED);
+    } else if (!block_add(h, new_block)) {
+        report_event(MSG_FATAL, "Couldn't allocate any more memory");
+        block_free(new_block);
+        return NULL;
+    }
+    profile_alloc(h, size, caller);
 
     return p;
 }
 
 /* Implementation of application functions */
 
+static void *timed_alloc(alloc_t alloc_type, size_t size, const void *caller)
+{
+    if (!timed_call())
+        return alloc(alloc_type, size, caller);
+
+    double rare = rare_seconds, start = harness_clock();
+    void *p = alloc(alloc_type, size, caller);
+    sample_time(start, rare);
+    return p;
+}
+
 void *test_malloc(size_t size)
 {
-    return alloc(TEST_MALLOC, size);
+    return timed_alloc(TEST_MALLOC, size, __builtin_return_address(0));
 }
 
 // cppcheck-suppress unusedFunction
@@ -184,10 +891,45 @@ void *test_calloc(size_t nelem, size_t elsize)
      */
     if (!nelem || !elsize || nelem > SIZE_MAX / elsize)
         return NULL;
-    return alloc(TEST_CALLOC, nelem * elsize);
+    return timed_alloc(TEST_CALLOC, nelem * elsize,
+                       __builtin_return_address(0));
 }
 
-void test_free(void *p)
+/* Account for n blocks of the given total size freed by the thread of h */
+static inline void account_free(block_heap_t *h, size_t n, size_t bytes)
+{
+    profile_add(&h->frees, n);
+    __atomic_sub_fetch(&live_bytes, bytes, __ATOMIC_RELAXED);
+}
+
+/* Check the header and footer of block b being freed, then mark it freed and
+ * poison it if asked to or sampled
+ */
+static void block_retire(block_element_t *b, bool poison)
+{
+    void *p = b->payload;
+    if (b->magic_header != MAGICHEADER && b->magic_header != MAGICARENA) {
+        report_event(
+            MSG_ERROR,
+            "Attempted to free unallocated or corrupted block.  Address = %p",
+            p);
+        set_error();
+    }
+    if (*find_footer(b) != MAGICFOOTER ||
+        (b->guarded && !guard_pad_intact(b))) {
+        report_event(MSG_ERROR,
+                     "Corruption detected in block with address %p when "
+                     "attempting to free it",
+                     p);
+        set_error();
+    }
+    b->magic_header = MAGICFREE;
+    *find_footer(b) = MAGICFREE;
+    if (poison || sample_block(&poison_count))
+        memset(p, FILLCHAR, b->payload_size);
+}
+
+static void release(void *p)
 {
     if (noallocate_mode) {
         report_event(MSG_FATAL, "Calls to free disallowed");
@@ -197,38 +939,118 @@ void test_free(void *p)
     if (!p)
         return;
 
-    block_element_t *b = find_header(p);
-    size_t footer = *find_footer(b);
-    if (footer != MAGICFOOTER) {
+    block_heap_t *h = heap_get();
+    block_element_t *b = find_header(h, p);
+    if (!b)
+        return;
+    bool in_arena = b->magic_header == MAGICARENA;
+    block_retire(b, quarantine_size && !in_arena);
+    account_free(h, 1, b->payload_size);
+
+    if (b->heap_id != h->id) {
+        block_heap_t *owner =
+            __atomic_load_n(&heaps[b->heap_id], __ATOMIC_ACQUIRE);
+        if (in_arena)
+            __atomic_add_fetch(&owner->arena_remote, 1, __ATOMIC_RELAXED);
+        else
+            heap_push_remote(owner, b);
+        return;
+    }
+    if (in_arena) {
+        __atomic_store_n(&h->arena_count, h->arena_count - 1,
+                         __ATOMIC_RELAXED);
+        return;
+    }
+    if (!block_remove(h, b)) {
         report_event(MSG_ERROR,
-                     "Corruption detected in block with address %p when "
-                     "attempting to free it",
-                     p);
-        error_occurred = true;
+                     "Attempted to free unallocated block.  Address = %p", p);
+        set_error();
+        return;
     }
-    b->magic_header = MAGICFREE;
-    *find_footer(b) = MAGICFREE;
-    memset(p, FILLCHAR, b->payload_size);
-
-    /* Unlink from list */
-    block_element_t *bn = b->next;
-    block_element_t *bp = b->prev;
-    if (bp)
-        bp->next = bn;
+    if (quarantine_size || h->quarantine_cap)
+        quarantine_push(h, b);
     else
-        allocated = bn;
-    if (bn)
-        bn->prev = bp;
+        block_free(b);
+}
 
-    free(b);
-    allocated_count--;
+void test_free(void *p)
+{
+    if (!timed_call()) {
+        release(p);
+        return;
+    }
+
+    double rare = rare_seconds, start = harness_clock();
+    release(p);
+    sample_time(start, rare);
+}
+
+/* Blocks ahead of the one being freed whose header and slot are prefetched */
+#define BATCH_PREFETCH 8
+
+/* Release the blocks of ptrs. Those of the calling thread outside an arena
+ * are looked up and unlinked by a single probe, while the headers and slots
+ * of the next ones are fetched. The others take the path of test_free.
+ */
+static void release_batch(void **ptrs, size_t n)
+{
+    if (noallocate_mode) {
+        report_event(MSG_FATAL, "Calls to free disallowed");
+        return;
+    }
+
+    block_heap_t *h = heap_get();
+    bool quarantine = quarantine_size || h->quarantine_cap;
+    size_t bytes = 0, frees = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (i + BATCH_PREFETCH < n && ptrs[i + BATCH_PREFETCH] && h->table) {
+            const block_element_t *next =
+                (block_element_t *) ((size_t) ptrs[i + BATCH_PREFETCH] -
+                                     sizeof(block_element_t));
+            __builtin_prefetch(next, 1);
+            __builtin_prefetch(&h->table[block_hash(next, h->bits)], 1);
+        }
+
+        void *p = ptrs[i];
+        if (!p)
+            continue;
+        /* The header is only read once the block is known to be allocated */
+        block_element_t *b =
+            (block_element_t *) ((size_t) p - sizeof(block_element_t));
+        if (!block_remove(h, b)) {
+            release(p);
+            continue;
+        }
+        block_retire(b, quarantine_size);
+        bytes += b->payload_size;
+        frees++;
+        if (quarantine)
+            quarantine_push(h, b);
+        else
+            block_free(b);
+    }
+    account_free(h, frees, bytes);
+}
+
+void test_free_batch(void **ptrs, size_t n)
+{
+    if (!harness_timing) {
+        release_batch(ptrs, n);
+        return;
+    }
+
+    /* Timed in full, being as long as many calls */
+    double rare = rare_seconds, start = harness_clock();
+    release_batch(ptrs, n);
+    double t = harness_clock() - start - clock_overhead;
+    harness_seconds += t - (rare_seconds - rare);
 }
 
 // cppcheck-suppress unusedFunction
 char *test_strdup(const char *s)
 {
     size_t len = strlen(s) + 1;
-    void *new = test_malloc(len);
+    void *new = timed_alloc(TEST_MALLOC, len, __builtin_return_address(0));
     if (!new)
         return NULL;
 
@@ -237,11 +1059,59 @@ char *test_strdup(const char *s)
 
 size_t allocation_check()
 {
-    return allocated_count;
+    if (my_heap)
+        heap_get();
+
+    size_t n = 0;
+    pthread_mutex_lock(&heaps_lock);
+    for (uint32_t i = 0; i < heap_count; i++) {
+        block_heap_t *h = heaps[i];
+        if (h->orphan)
+            heap_drain(h);
+        n += __atomic_load_n(&h->count, __ATOMIC_RELAXED) -
+             __atomic_load_n(&h->remote_count, __ATOMIC_RELAXED) +
+             __atomic_load_n(&h->arena_count, __ATOMIC_RELAXED) -
+             __atomic_load_n(&h->arena_remote, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&heaps_lock);
+    return n;
 }
 
 /* Implementation of functions for testing */
 
+/* Return the position of the arena of the calling thread, to be given to
+ * harness_reset()
+ */
+size_t harness_mark()
+{
+    arena_chunk_t *c = heap_get()->arena;
+    return c ? c->start + c->used : 0;
+}
+
+/* Drop every arena block the calling thread allocated since mark, keeping
+ * the first chunk for reuse. Return how many of them were still allocated.
+ */
+size_t harness_reset(size_t mark)
+{
+    block_heap_t *h = heap_get();
+    size_t dropped = 0, bytes = 0;
+    for (arena_chunk_t *c = h->arena; c && c->start + c->used > mark;
+         c = h->arena) {
+        size_t from = mark > c->start ? mark - c->start : 0;
+        dropped += arena_count_live(c, from, &bytes);
+        if (from || !c->prev) {
+            c->used = from;
+            break;
+        }
+        h->arena = c->prev;
+        munmap(c, c->size + sizeof(arena_chunk_t));
+    }
+    __atomic_store_n(&h->arena_count, h->arena_count - dropped,
+                     __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&live_bytes, bytes, __ATOMIC_RELAXED);
+    return dropped;
+}
+
 /* Set/unset cautious mode.
  * In this mode, makes extra sure any block to be freed is currently allocated.
  */
@@ -250,6 +1120,114 @@ void set_cautious_mode(bool cautious)
     cautious_mode = cautious;
 }
 
+/* Sum the allocation profiles of all threads */
+void harness_stats(harness_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    pthread_mutex_lock(&heaps_lock);
+    for (uint32_t i = 0; i < heap_count; i++) {
+        const block_heap_t *h = heaps[i];
+        stats->allocs += __atomic_load_n(&h->allocs, __ATOMIC_RELAXED);
+        stats->frees += __atomic_load_n(&h->frees, __ATOMIC_RELAXED);
+        for (int k = 0; k < HARNESS_SIZE_CLASSES; k++)
+            stats->size_classes[k] +=
+                __atomic_load_n(&h->size_classes[k], __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&heaps_lock);
+    stats->live_bytes = __atomic_load_n(&live_bytes, __ATOMIC_RELAXED);
+    stats->peak_bytes = __atomic_load_n(&peak_bytes, __ATOMIC_RELAXED);
+    stats->overhead = sizeof(block_element_t) + sizeof(size_t);
+}
+
+static int cmp_site(const void *a, const void *b)
+{
+    const harness_site_t *sa = a, *sb = b;
+    return (sa->allocs < sb->allocs) - (sa->allocs > sb->allocs);
+}
+
+/* Fill sites with the n call sites of all threads allocating most often */
+size_t harness_sites(harness_site_t *sites, size_t n)
+{
+    harness_site_t *all = NULL;
+    size_t count = 0;
+    pthread_mutex_lock(&heaps_lock);
+    all = calloc((size_t) heap_count * (SITE_SLOTS + 1), sizeof(*all));
+    for (uint32_t i = 0; all && i < heap_count; i++) {
+        const block_heap_t *h = heaps[i];
+        for (int j = 0; j <= SITE_SLOTS; j++) {
+            harness_site_t site = {
+                .caller = __atomic_load_n(&h->sites[j].caller,
+                                          __ATOMIC_RELAXED),
+                .allocs = __atomic_load_n(&h->sites[j].allocs,
+                                          __ATOMIC_RELAXED),
+                .bytes = __atomic_load_n(&h->sites[j].bytes, __ATOMIC_RELAXED),
+            };
+            if (!site.allocs)
+                continue;
+            size_t k = 0;
+            while (k < count && all[k].caller != site.caller)
+                k++;
+            if (k == count)
+                all[count++].caller = site.caller;
+            all[k].allocs += site.allocs;
+            all[k].bytes += site.bytes;
+        }
+    }
+    pthread_mutex_unlock(&heaps_lock);
+    if (!all)
+        return 0;
+
+    qsort(all, count, sizeof(*all), cmp_site);
+    if (n > count)
+        n = count;
+    memcpy(sites, all, n * sizeof(*sites));
+    free(all);
+    return n;
+}
+
+/* Clear the allocation profiles, starting the peak from the live bytes.
+ * Allocations other threads make meanwhile may be partly counted.
+ */
+void harness_stats_reset()
+{
+    pthread_mutex_lock(&heaps_lock);
+    for (uint32_t i = 0; i < heap_count; i++) {
+        block_heap_t *h = heaps[i];
+        __atomic_store_n(&h->allocs, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&h->frees, 0, __ATOMIC_RELAXED);
+        for (int k = 0; k < HARNESS_SIZE_CLASSES; k++)
+            __atomic_store_n(&h->size_classes[k], 0, __ATOMIC_RELAXED);
+        for (int j = 0; j <= SITE_SLOTS; j++) {
+            __atomic_store_n(&h->sites[j].caller, NULL, __ATOMIC_RELAXED);
+            __atomic_store_n(&h->sites[j].allocs, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&h->sites[j].bytes, 0, __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&h->site_count, 0, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&heaps_lock);
+    size_t live = __atomic_load_n(&live_bytes, __ATOMIC_RELAXED);
+    __atomic_store_n(&peak_bytes, live, __ATOMIC_RELAXED);
+}
+
+/* Start/stop measuring the time spent in the harness */
+void set_harness_timing(bool timing)
+{
+    if (clock_overhead < 0)
+        calibrate_clock();
+    harness_timing = timing;
+    timing_count = 0;
+}
+
+/* Return seconds the calling thread spent in the harness since last time
+ * checked
+ */
+double harness_time()
+{
+    double t = harness_seconds;
+    harness_seconds = 0;
+    return t;
+}
+
 /* Set/unset restricted allocation mode.
  * In this mode, calls to malloc and free are disallowed.
  */
@@ -258,12 +1236,51 @@ void set_noallocate_mode(bool noallocate)
     noallocate_mode = noallocate;
 }
 
-/* Return whether any errors have occurred since last time set error limit */
+/* Return whether any errors have occurred since last time set error limit,
+ * checking first the quarantine of the calling thread
+ */
 bool error_check()
 {
-    bool e = error_occurred;
-    error_occurred = false;
-    return e;
+    if (my_heap && my_heap->quarantine_count)
+        quarantine_check(my_heap);
+    return __atomic_exchange_n(&error_occurred, false, __ATOMIC_RELAXED);
+}
+
+/* Arm the timer raising SIGALRM once time_limit_ms have passed */
+static void time_limit_start()
+{
+    struct itimerval timer = {
+        .it_value = {.tv_sec = time_limit_ms / 1000,
+                     .tv_usec = time_limit_ms % 1000 * 1000},
+    };
+    if (time_limit_ms > 0) {
+        assert(pthread_equal(pthread_self(), main_thread));
+        setitimer(ITIMER_REAL, &timer, NULL);
+    }
+    guard_start = harness_clock();
+}
+
+/* Disarm the timer and account how long the guarded code ran */
+static void time_limit_stop()
+{
+    const struct itimerval off = {0};
+    if (time_limit_ms > 0)
+        setitimer(ITIMER_REAL, &off, NULL);
+    time_limited = false;
+    guard_seconds += harness_clock() - guard_start;
+    guard_count++;
+}
+
+/* Return how many operations the calling thread ran with a time limit since
+ * last time checked, and set seconds to the time they took
+ */
+size_t guarded_time(double *seconds)
+{
+    size_t n = guard_count;
+    *seconds = guard_seconds;
+    guard_seconds = 0;
+    guard_count = 0;
+    return n;
 }
 
 /* Prepare for a risky operation using setjmp.
@@ -274,13 +1291,10 @@ bool exception_setup(bool limit_time)
     if (sigsetjmp(env, 1)) {
         /* Got here from longjmp */
         jmp_ready = false;
-        if (time_limited) {
-            alarm(0);
-            time_limited = false;
-        }
-
         if (error_message)
             report_event(MSG_ERROR, error_message);
+        if (time_limited)
+            time_limit_stop();
         error_message = "";
         return false;
     }
@@ -288,7 +1302,7 @@ bool exception_setup(bool limit_time)
     /* Got here from initial call */
     jmp_ready = true;
     if (limit_time) {
-        alarm(time_limit);
+        time_limit_start();
         time_limited = true;
     }
     return true;
@@ -297,10 +1311,8 @@ bool exception_setup(bool limit_time)
 /* Call once past risky code */
 void exception_cancel()
 {
-    if (time_limited) {
-        alarm(0);
-        time_limited = false;
-    }
+    if (time_limited)
+        time_limit_stop();
 
     jmp_ready = false;
     error_message = "";
@@ -309,7 +1321,7 @@ void exception_cancel()
 /* Use longjmp to return to most recent exception setup */
 void trigger_exception(char *msg)
 {
-    error_occurred = true;
+    set_error();
     error_message = msg;
     if (jmp_ready)
         siglongjmp(env, 1);
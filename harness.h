@@ -8,21 +8,102 @@
 /* This test harness enables us to do stringent testing of code.
  * It overloads the library versions of malloc and free with ones that
  * allow checking for common allocation errors.
+ *
+ * The allocation functions are thread-safe: every thread tracks its own
+ * blocks, and a block may be freed by any thread.
  */
 
 void *test_malloc(size_t size);
 void *test_calloc(size_t nmemb, size_t size);
 void test_free(void *p);
+/* Free the n blocks of ptrs, skipping NULL ones, faster than one by one */
+void test_free_batch(void **ptrs, size_t n);
 char *test_strdup(const char *s);
 /* FIXME: provide test_realloc as well */
 
 #ifdef INTERNAL
 
-/* Report number of allocated blocks */
+/* Report number of blocks allocated by all threads */
 size_t allocation_check();
 
-/* Probability of malloc failing, expressed as percent */
+/* Number of classes of allocation sizes, by power of two */
+#define HARNESS_SIZE_CLASSES 64
+
+/* Allocation profile, summed over all threads */
+typedef struct {
+    size_t allocs, frees; /* Calls which succeeded */
+    size_t live_bytes;    /* Payload bytes allocated and not freed */
+    size_t peak_bytes;    /* Maximum of live_bytes since last reset */
+    size_t overhead;      /* Bytes added to the payload of every block */
+    /* Allocations of 2^k to 2^(k+1) - 1 bytes in class k, of 0 in class 0 */
+    size_t size_classes[HARNESS_SIZE_CLASSES];
+} harness_stats_t;
+
+/* Allocations made from one call site */
+typedef struct {
+    const void *caller; /* Return address of the calls, NULL for the rest */
+    size_t allocs, bytes;
+} harness_site_t;
+
+/* Get the allocation profile */
+void harness_stats(harness_stats_t *stats);
+
+/*
+ * Fill sites with the n call sites allocating most often, or fewer if there
+ * are not as many. Return how many were filled.
+ */
+size_t harness_sites(harness_site_t *sites, size_t n);
+
+/* Clear the allocation profile, starting the peak from the live bytes */
+void harness_stats_reset();
+
+/*
+ * Fault injection schedules, making an allocation fail if any of them says
+ * so. Allocations are counted from 1 by each thread.
+ * fail_probability: percent of allocations failing at random, drawn from a
+ * xorshift generator seeded by fail_seed so that runs can be repeated
+ * fail_every: fail every Nth allocation, none if 0
+ * fail_first, fail_last: fail allocations fail_first to fail_last, and all
+ * from fail_first on if fail_last is 0, none if fail_first is 0
+ * Changes take effect, restarting the counts and generators, on calling
+ * reset_fault_injection().
+ */
 extern int fail_probability;
+extern int fail_seed;
+extern int fail_every;
+extern int fail_first, fail_last;
+void reset_fault_injection();
+
+/*
+ * Carve blocks one after another from large chunks, mapped with huge pages
+ * if set to 2. Freeing such a block only poisons it; its memory is given
+ * back by harness_reset().
+ */
+extern int arena_mode;
+
+/*
+ * Map every payload of guard_size bytes or more on pages of its own, ending
+ * where an inaccessible page starts, so that overrunning it raises SIGSEGV
+ * at once. Payloads stay aligned as by malloc(), and overruns into the few
+ * bytes of padding this leaves are reported when the block is freed. None
+ * are mapped if 0, nor in arena mode. Every such block takes two mappings,
+ * and blocks are allocated as usual once the process runs out.
+ */
+extern int guard_size;
+
+/*
+ * Keep up to quarantine_size freed blocks of every thread poisoned instead of
+ * releasing them, and report a use after free if they are no longer poisoned
+ * when released. Every error_check() also checks the next few of them, going
+ * round the quarantine. None are kept if 0. Arena blocks are only poisoned.
+ */
+extern int quarantine_size;
+
+/*
+ * Fill new payloads and poison freed ones in only one block of every
+ * poison_interval, or in none if 0. Header and footer checks are unaffected.
+ */
+extern int poison_interval;
 
 /*
  * Set/unset cautious mode.
@@ -36,11 +117,40 @@ void set_cautious_mode(bool cautious);
  */
 void set_noallocate_mode(bool noallocate);
 
+/* Return the position of the arena of the calling thread */
+size_t harness_mark();
+
+/*
+ * Drop at once every block the calling thread allocated in arena mode since
+ * position mark, 0 for all of them, freed or not. Return the number of those
+ * still allocated, which no longer count as allocated.
+ */
+size_t harness_reset(size_t mark);
+
+/* Start/stop measuring the time spent in the harness */
+void set_harness_timing(bool timing);
+
+/* Return seconds the calling thread spent in the harness since last time
+ * checked
+ */
+double harness_time();
+
 /* Return whether any errors have occurred since last time checked */
 bool error_check();
 
-/* Prepare for a risky operation using setjmp.
- * Function returns true for initial return, false for error return
+/* Milliseconds an operation guarded with a time limit may run, none if 0 */
+extern int time_limit_ms;
+
+/* Return how many operations the calling thread ran with a time limit since
+ * last time checked, and set seconds to the time they took
+ */
+size_t guarded_time(double *seconds);
+
+/* Prepare for a risky operation of the calling thread using setjmp.
+ * Function returns true for initial return, false for error return.
+ * With limit_time, SIGALRM is raised after time_limit_ms. The timer is shared
+ * by the whole process, so only the main thread may limit time, and other
+ * threads have to block SIGALRM while it does.
  */
 bool exception_setup(bool limit_time);
 
@@ -0,0 +1,304 @@
+#include "iqueue.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Words of the arena are addressed by 32-bit index, like the node heap of
+ * tools/fmtscan.c. A node at index i keeps the index of its successor in
+ * word i and of its predecessor in word i + 1, its string starts at word
+ * i + 2. The head is a node without string at index 0.
+ */
+#define IQ_HEAD_WORDS 2
+#define IQ_MIN_CAP 16
+
+#define LINK_NEXT(w, i) ((w)[(i)])
+#define LINK_PREV(w, i) ((w)[(i) + 1])
+#define NODE_VALUE(w, i) ((char *) &(w)[(i) + 2])
+
+/* Number of words taken by a node holding a string of len characters */
+static inline uint64_t node_words(size_t len)
+{
+    return IQ_HEAD_WORDS + (len + sizeof(uint32_t)) / sizeof(uint32_t);
+}
+
+/* Make room for words more words, growing the arena geometrically */
+static bool iq_reserve(iqueue_t *q, uint64_t words)
+{
+    uint64_t need = (uint64_t) q->used + words;
+    if (need <= q->cap)
+        return true;
+    if (need > UINT32_MAX)
+        return false;
+
+    uint64_t cap = q->cap;
+    while (cap < need)
+        cap *= 2;
+    if (cap > UINT32_MAX)
+        cap = UINT32_MAX;
+    uint32_t *arena = realloc(q->arena, cap * sizeof(uint32_t));
+    if (!arena)
+        return false;
+    q->arena = arena;
+    q->cap = cap;
+    return true;
+}
+
+/* Copy string s into a new unlinked node */
+static uint32_t node_new(iqueue_t *q, const char *s)
+{
+    size_t len = strlen(s);
+    uint64_t words = node_words(len);
+    if (!iq_reserve(q, words))
+        return 0;
+
+    uint32_t i = q->used;
+    q->used += words;
+    memcpy(NODE_VALUE(q->arena, i), s, len + 1);
+    return i;
+}
+
+/* Link node i in front of node next, which is 0 for the tail */
+static inline void node_link(uint32_t *w, uint32_t i, uint32_t next)
+{
+    uint32_t prev = LINK_PREV(w, next);
+    LINK_NEXT(w, i) = next;
+    LINK_PREV(w, i) = prev;
+    LINK_NEXT(w, prev) = i;
+    LINK_PREV(w, next) = i;
+}
+
+/* Move the nodes into a fresh arena in list order, dropping the holes */
+static void iq_compact_arena(iqueue_t *q)
+{
+    uint64_t cap = IQ_MIN_CAP;
+    while (cap < 2 * (uint64_t) (q->used - q->garbage))
+        cap *= 2;
+    if (cap > UINT32_MAX)
+        cap = UINT32_MAX;
+    uint32_t *arena = malloc(cap * sizeof(uint32_t));
+    if (!arena)
+        return; /* Keep the holes, they are only wasted space */
+
+    uint32_t *w = q->arena, used = IQ_HEAD_WORDS, prev = 0;
+    for (uint32_t i = LINK_NEXT(w, 0); i; i = LINK_NEXT(w, i)) {
+        size_t len = strlen(NODE_VALUE(w, i));
+        memcpy(NODE_VALUE(arena, used), NODE_VALUE(w, i), len + 1);
+        LINK_NEXT(arena, prev) = used;
+        LINK_PREV(arena, used) = prev;
+        prev = used;
+        used += node_words(len);
+    }
+    LINK_NEXT(arena, prev) = 0;
+    LINK_PREV(arena, 0) = prev;
+
+    free(q->arena);
+    q->arena = arena;
+    q->cap = cap;
+    q->used = used;
+    q->garbage = 0;
+}
+
+/* Create an empty queue */
+iqueue_t *iq_new(void)
+{
+    iqueue_t *q = malloc(sizeof(iqueue_t));
+    if (!q)
+        return NULL;
+
+    q->arena = malloc(IQ_MIN_CAP * sizeof(uint32_t));
+    if (!q->arena) {
+        free(q);
+        return NULL;
+    }
+    LINK_NEXT(q->arena, 0) = LINK_PREV(q->arena, 0) = 0;
+    q->used = IQ_HEAD_WORDS;
+    q->cap = IQ_MIN_CAP;
+    q->garbage = 0;
+    q->size = 0;
+    return q;
+}
+
+/* Free all storage used by queue */
+void iq_free(iqueue_t *q)
+{
+    if (!q)
+        return;
+    free(q->arena);
+    free(q);
+}
+
+static bool iq_insert(iqueue_t *q, const char *s, bool tail)
+{
+    if (!q || !s)
+        return false;
+
+    uint32_t i = node_new(q, s);
+    if (!i)
+        return false;
+    node_link(q->arena, i, tail ? 0 : LINK_NEXT(q->arena, 0));
+    q->size++;
+    return true;
+}
+
+/* Insert a copy of string s at head of queue */
+bool iq_insert_head(iqueue_t *q, const char *s)
+{
+    return iq_insert(q, s, false);
+}
+
+/* Insert a copy of string s at tail of queue */
+bool iq_insert_tail(iqueue_t *q, const char *s)
+{
+    return iq_insert(q, s, true);
+}
+
+static bool iq_remove(iqueue_t *q, char *sp, size_t bufsize, bool tail)
+{
+    if (!q || !q->size)
+        return false;
+
+    uint32_t *w = q->arena;
+    uint32_t i = tail ? LINK_PREV(w, 0) : LINK_NEXT(w, 0);
+    LINK_NEXT(w, LINK_PREV(w, i)) = LINK_NEXT(w, i);
+    LINK_PREV(w, LINK_NEXT(w, i)) = LINK_PREV(w, i);
+
+    const char *value = NODE_VALUE(w, i);
+    size_t len = strlen(value);
+    if (sp && bufsize) {
+        size_t n = len < bufsize - 1 ? len : bufsize - 1;
+        memcpy(sp, value, n);
+        sp[n] = '\0';
+    }
+
+    q->size--;
+    q->garbage += node_words(len);
+    if (q->garbage > q->used / 2)
+        iq_compact_arena(q);
+    return true;
+}
+
+/* Remove the element from head of queue */
+bool iq_remove_head(iqueue_t *q, char *sp, size_t bufsize)
+{
+    return iq_remove(q, sp, bufsize, false);
+}
+
+/* Remove the element from tail of queue */
+bool iq_remove_tail(iqueue_t *q, char *sp, size_t bufsize)
+{
+    return iq_remove(q, sp, bufsize, true);
+}
+
+/* Reverse elements in queue */
+void iq_reverse(iqueue_t *q)
+{
+    if (!q)
+        return;
+
+    uint32_t *w = q->arena, i = 0;
+    do {
+        uint32_t next = LINK_NEXT(w, i);
+        LINK_NEXT(w, i) = LINK_PREV(w, i);
+        LINK_PREV(w, i) = next;
+        i = next;
+    } while (i);
+}
+
+/* Merge two 0-terminated runs chained through their next links */
+static uint32_t merge_runs(uint32_t *w, uint32_t a, uint32_t b, bool descend)
+{
+    uint32_t head = 0, *tail = &head;
+    while (a && b) {
+        int cmp = strcmp(NODE_VALUE(w, a), NODE_VALUE(w, b));
+        if (descend ? cmp >= 0 : cmp <= 0) {
+            *tail = a;
+            tail = &LINK_NEXT(w, a);
+            a = *tail;
+        } else {
+            *tail = b;
+            tail = &LINK_NEXT(w, b);
+            b = *tail;
+        }
+    }
+    *tail = a ? a : b;
+    return head;
+}
+
+/* Sort elements of queue in ascending/descending order */
+void iq_sort(iqueue_t *q, bool descend)
+{
+    if (!q || q->size < 2)
+        return;
+
+    /* Bottom-up merge sort: pending[k] holds a sorted run of 2^k nodes, made
+     * of nodes older than those of pending[j] for any j < k.
+     */
+    uint32_t *w = q->arena;
+    uint32_t pending[32] = {0};
+    LINK_NEXT(w, LINK_PREV(w, 0)) = 0;
+    for (uint32_t i = LINK_NEXT(w, 0), next; i; i = next) {
+        next = LINK_NEXT(w, i);
+        LINK_NEXT(w, i) = 0;
+
+        uint32_t run = i;
+        int k = 0;
+        for (; pending[k]; k++) {
+            run = merge_runs(w, pending[k], run, descend);
+            pending[k] = 0;
+        }
+        pending[k] = run;
+    }
+
+    uint32_t run = 0;
+    for (int k = 0; k < 32; k++) {
+        if (pending[k])
+            run = run ? merge_runs(w, pending[k], run, descend) : pending[k];
+    }
+
+    /* Restore the prev links and close the circle */
+    uint32_t prev = 0;
+    LINK_NEXT(w, 0) = run;
+    for (uint32_t i = run; i; i = LINK_NEXT(w, i)) {
+        LINK_PREV(w, i) = prev;
+        prev = i;
+    }
+    LINK_NEXT(w, prev) = 0;
+    LINK_PREV(w, 0) = prev;
+}
+
+/* Merge a sorted queue into another one */
+bool iq_merge(iqueue_t *q, iqueue_t *from, bool descend)
+{
+    if (!q || !from)
+        return false;
+    if (q == from || !from->size)
+        return true;
+    if (!iq_reserve(q, from->used - from->garbage - IQ_HEAD_WORDS))
+        return false;
+
+    uint32_t *w = q->arena, *fw = from->arena;
+    uint32_t cur = LINK_NEXT(w, 0);
+    for (uint32_t i = LINK_NEXT(fw, 0); i; i = LINK_NEXT(fw, i)) {
+        const char *s = NODE_VALUE(fw, i);
+        while (cur) {
+            int cmp = strcmp(s, NODE_VALUE(w, cur));
+            if (descend ? cmp > 0 : cmp < 0)
+                break;
+            cur = LINK_NEXT(w, cur);
+        }
+        node_link(w, node_new(q, s), cur);
+    }
+    q->size += from->size;
+
+    LINK_NEXT(fw, 0) = LINK_PREV(fw, 0) = 0;
+    from->used = IQ_HEAD_WORDS;
+    from->garbage = 0;
+    from->size = 0;
+    return true;
+}
+
+/* Get the memory held by queue */
+size_t iq_bytes(const iqueue_t *q)
+{
+    return q ? sizeof(iqueue_t) + (size_t) q->cap * sizeof(uint32_t) : 0;
+}
@@ -0,0 +1,176 @@
+#ifndef LAB0_IQUEUE_H
+#define LAB0_IQUEUE_H
+
+/* A compact variant of the queue in queue.h.
+ *
+ * Elements live in one growable arena of 32-bit words. Each node is two
+ * 32-bit word indices linking it to its neighbours, followed by its string,
+ * stored inline and padded to a word boundary. Index 0 is the head of the
+ * circular list, so a node costs 8 bytes plus its string instead of an
+ * element_t, a separately allocated string and the allocator overhead of
+ * both.
+ *
+ * Removed nodes leave holes in the arena, which is compacted into list order
+ * once the holes take more than half of it.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * iqueue_t - Queue whose nodes are linked by arena indices
+ * @arena: words holding the head and all nodes
+ * @used: number of words handed out, holes included
+ * @cap: number of words allocated
+ * @garbage: number of words in holes left by removed nodes
+ * @size: number of elements
+ */
+typedef struct {
+    uint32_t *arena;
+    uint32_t used;
+    uint32_t cap;
+    uint32_t garbage;
+    uint32_t size;
+} iqueue_t;
+
+/**
+ * iq_new() - Create an empty queue
+ *
+ * Return: the new queue, or NULL for allocation failed
+ */
+iqueue_t *iq_new(void);
+
+/**
+ * iq_free() - Free all storage used by queue
+ * @q: queue to be freed, which may be NULL
+ */
+void iq_free(iqueue_t *q);
+
+/**
+ * iq_insert_head() - Insert a copy of string s at head of queue
+ * @q: queue to insert into
+ * @s: string to be copied into the arena
+ *
+ * Return: true for success, false for allocation failed or queue is NULL
+ */
+bool iq_insert_head(iqueue_t *q, const char *s);
+
+/**
+ * iq_insert_tail() - Insert a copy of string s at tail of queue
+ * @q: queue to insert into
+ * @s: string to be copied into the arena
+ *
+ * Return: true for success, false for allocation failed or queue is NULL
+ */
+bool iq_insert_tail(iqueue_t *q, const char *s);
+
+/**
+ * iq_remove_head() - Remove the element from head of queue
+ * @q: queue to remove from
+ * @sp: output buffer where the removed string is copied, or NULL
+ * @bufsize: size of the string buffer
+ *
+ * The string is copied like q_remove_head() does, since its storage goes
+ * back to the arena.
+ *
+ * Return: true for success, false if queue is NULL or empty.
+ */
+bool iq_remove_head(iqueue_t *q, char *sp, size_t bufsize);
+
+/**
+ * iq_remove_tail() - Remove the element from tail of queue
+ * @q: queue to remove from
+ * @sp: output buffer where the removed string is copied, or NULL
+ * @bufsize: size of the string buffer
+ *
+ * Return: true for success, false if queue is NULL or empty.
+ */
+bool iq_remove_tail(iqueue_t *q, char *sp, size_t bufsize);
+
+/**
+ * iq_size() - Get the number of elements in queue
+ * @q: queue to be examined
+ *
+ * Return: the number of elements in queue, zero if queue is NULL or empty
+ */
+static inline uint32_t iq_size(const iqueue_t *q)
+{
+    return q ? q->size : 0;
+}
+
+/**
+ * iq_first() - Get the index of the first node of queue
+ * @q: queue to be examined
+ *
+ * Return: the index of the first node, 0 if queue is empty
+ */
+static inline uint32_t iq_first(const iqueue_t *q)
+{
+    return q->arena[0];
+}
+
+/**
+ * iq_next() - Get the index of the node following node i
+ * @q: queue holding node i
+ * @i: index of a node
+ *
+ * Return: the index of the next node, 0 at the end of queue
+ */
+static inline uint32_t iq_next(const iqueue_t *q, uint32_t i)
+{
+    return q->arena[i];
+}
+
+/**
+ * iq_value() - Get the string held by node i
+ * @q: queue holding node i
+ * @i: index of a node, not 0
+ *
+ * Return: the string, valid until the next insertion or removal
+ */
+static inline const char *iq_value(const iqueue_t *q, uint32_t i)
+{
+    return (const char *) &q->arena[i + 2];
+}
+
+/**
+ * iq_reverse() - Reverse elements in queue
+ * @q: queue to be reversed
+ *
+ * No nodes are moved, only their links are swapped.
+ */
+void iq_reverse(iqueue_t *q);
+
+/**
+ * iq_sort() - Sort elements of queue in ascending/descending order
+ * @q: queue to be sorted
+ * @descend: whether to sort in descending order
+ *
+ * The sort is stable and works on the links only. No allocation is done.
+ */
+void iq_sort(iqueue_t *q, bool descend);
+
+/**
+ * iq_merge() - Merge a sorted queue into another one
+ * @q: sorted queue receiving all the elements
+ * @from: sorted queue, left empty
+ * @descend: whether the queues are sorted in descending order
+ *
+ * The nodes of @from are copied into the arena of @q and linked in place,
+ * elements of @q coming first among equals. The arena of @q grows once up
+ * front, so the merge never fails half way.
+ *
+ * Return: true for success, false for allocation failed or queue is NULL.
+ */
+bool iq_merge(iqueue_t *q, iqueue_t *from, bool descend);
+
+/**
+ * iq_bytes() - Get the memory held by queue
+ * @q: queue to be examined
+ *
+ * Return: the number of bytes allocated for queue and its arena
+ */
+size_t iq_bytes(const iqueue_t *q);
+
+#endif /* LAB0_IQUEUE_H */
@@ -462,6 +462,173 @@ static inline void list_move_tail(struct list_head *node,
          ++(entry), ++(safe))
 #endif
 
+/**
+ * struct hlist_head - Head of a singly-linked hash bucket list
+ * @first: Pointer to the first node, NULL if the bucket is empty.
+ *
+ * Hash tables keep one head per bucket, so the head holds a single pointer to
+ * halve the size of the bucket array compared with struct list_head. The list
+ * is not circular and its last node has a NULL @next.
+ */
+struct hlist_head {
+    struct hlist_node *first;
+};
+
+/**
+ * struct hlist_node - Node of a hash bucket list
+ * @next: Pointer to the next node, NULL at the end of the bucket.
+ * @pprev: Address of the pointer which points to this node, either @first of
+ *         the head or @next of the previous node. NULL for an unlinked node.
+ *
+ * Keeping the address of the referring pointer instead of the previous node
+ * lets a node be removed in constant time without knowing its bucket.
+ */
+struct hlist_node {
+    struct hlist_node *next, **pprev;
+};
+
+/**
+ * INIT_HLIST_HEAD() - Initialize an empty hash bucket list
+ * @h: Pointer to the hlist_head structure to initialize.
+ */
+static inline void INIT_HLIST_HEAD(struct hlist_head *h)
+{
+    h->first = NULL;
+}
+
+/**
+ * INIT_HLIST_NODE() - Initialize an unlinked hash bucket node
+ * @n: Pointer to the hlist_node structure to initialize.
+ */
+static inline void INIT_HLIST_NODE(struct hlist_node *n)
+{
+    n->next = NULL;
+    n->pprev = NULL;
+}
+
+/**
+ * hlist_unhashed() - Test if a node is not linked into any bucket
+ * @n: Pointer to the hlist_node structure to test.
+ *
+ * Returns: non-zero if @n was initialized or removed with hlist_del_init().
+ */
+static inline int hlist_unhashed(const struct hlist_node *n)
+{
+    return !n->pprev;
+}
+
+/**
+ * hlist_empty() - Test if a hash bucket list has no nodes
+ * @h: Pointer to the hlist_head structure to test.
+ *
+ * Returns: non-zero if the bucket is empty.
+ */
+static inline int hlist_empty(const struct hlist_head *h)
+{
+    return !h->first;
+}
+
+/**
+ * hlist_del() - Remove a node from its hash bucket list
+ * @n: Pointer to the hlist_node structure to remove.
+ *
+ * As with list_del(), @n is left in an undefined state afterwards.
+ */
+static inline void hlist_del(struct hlist_node *n)
+{
+    struct hlist_node *next = n->next;
+    struct hlist_node **pprev = n->pprev;
+
+    *pprev = next;
+    if (next)
+        next->pprev = pprev;
+}
+
+/**
+ * hlist_del_init() - Remove a node from its bucket and mark it unlinked
+ * @n: Pointer to the hlist_node structure to remove.
+ *
+ * Does nothing if @n is not linked into a bucket.
+ */
+static inline void hlist_del_init(struct hlist_node *n)
+{
+    if (hlist_unhashed(n))
+        return;
+    hlist_del(n);
+    INIT_HLIST_NODE(n);
+}
+
+/**
+ * hlist_add_head() - Insert a node at the beginning of a hash bucket list
+ * @n: Pointer to the hlist_node structure to add.
+ * @h: Pointer to the hlist_head structure of the bucket.
+ */
+static inline void hlist_add_head(struct hlist_node *n, struct hlist_head *h)
+{
+    struct hlist_node *first = h->first;
+
+    n->next = first;
+    if (first)
+        first->pprev = &n->next;
+    h->first = n;
+    n->pprev = &h->first;
+}
+
+/**
+ * hlist_add_behind() - Insert a node after another one in a bucket
+ * @n: Pointer to the hlist_node structure to add.
+ * @prev: Pointer to a node already linked into a bucket.
+ */
+static inline void hlist_add_behind(struct hlist_node *n,
+                                    struct hlist_node *prev)
+{
+    n->next = prev->next;
+    prev->next = n;
+    n->pprev = &prev->next;
+    if (n->next)
+        n->next->pprev = &n->next;
+}
+
+/**
+ * hlist_entry() - Get the entry for this hash bucket node
+ * @node: pointer to hlist node
+ * @type: type of the entry containing the hlist node
+ * @member: name of the hlist_node member variable in struct @type
+ *
+ * Return: @type pointer of entry containing node
+ */
+#define hlist_entry(node, type, member) container_of(node, type, member)
+
+/**
+ * hlist_entry_safe() - Get the entry for a hash bucket node which may be NULL
+ * @node: pointer to hlist node, evaluated twice
+ * @type: type of the entry containing the hlist node
+ * @member: name of the hlist_node member variable in struct @type
+ *
+ * Return: @type pointer of entry containing node, NULL if @node is NULL
+ */
+#define hlist_entry_safe(node, type, member) \
+    ((node) ? hlist_entry(node, type, member) : NULL)
+
+/**
+ * hlist_for_each_entry - Iterate over the entries of a hash bucket
+ * @entry: Pointer to the structure type, used as the loop iterator.
+ * @head: Pointer to the hlist_head structure of the bucket.
+ * @member: Name of the hlist_node member within the structure type of @entry.
+ *
+ * Iterates from the first node of the bucket until the end. As with
+ * list_for_each_entry(), the bucket must not be modified while iterating.
+ */
+#if __LIST_HAVE_TYPEOF
+#define hlist_for_each_entry(entry, head, member)                            \
+    for (entry = hlist_entry_safe((head)->first, typeof(*entry), member); \
+         entry;                                                              \
+         entry = hlist_entry_safe(entry->member.next, typeof(*entry), member))
+#else
+#define hlist_for_each_entry(entry, head, member) \
+    for (entry = (void *) 1; sizeof(struct { int i : -1; }); ++(entry))
+#endif
+
 #undef __LIST_HAVE_TYPEOF
 
 #ifdef __cplusplus
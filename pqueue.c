@@ -0,0 +1,438 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* mremap */
+#endif
+
+#include "pqueue.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PQ_MAGIC 0x5130504cU /* "LP0Q" */
+#define PQ_VERSION 1
+#define PQ_HEAD_WORDS 2
+#define PQ_MIN_CAP 1024
+
+/* Holes are only compacted away in queues of at least this many words */
+#define PQ_COMPACT_MIN 4096
+
+/* Start of the file, followed by the node words */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t dir;  /* word of a node linking forward, 0 or 1 */
+    uint32_t used; /* node words handed out, holes included */
+    uint32_t reserved[4];
+} pq_header_t;
+
+static inline pq_header_t *header_of(const pqueue_t *q)
+{
+    return (pq_header_t *) q->map;
+}
+
+#define FWD(q, i) ((q)->arena[(i) + header_of(q)->dir])
+#define BWD(q, i) ((q)->arena[(i) + 1 - header_of(q)->dir])
+#define NODE_VALUE(w, i) ((char *) &(w)[(i) + 2])
+
+/* The store an operation takes effect with must not be moved before the
+ * stores preparing it, or a killed process could leave a broken chain.
+ */
+#define COMMIT(lvalue, value) \
+    __atomic_store_n(&(lvalue), (value), __ATOMIC_RELEASE)
+
+static inline size_t file_size(uint32_t cap)
+{
+    return sizeof(pq_header_t) + (size_t) cap * sizeof(uint32_t);
+}
+
+static inline uint64_t node_words(size_t len)
+{
+    return PQ_HEAD_WORDS + (len + sizeof(uint32_t)) / sizeof(uint32_t);
+}
+
+static bool pq_map(pqueue_t *q, uint32_t cap)
+{
+    void *map = mmap(NULL, file_size(cap), PROT_READ | PROT_WRITE, MAP_SHARED,
+                     q->fd, 0);
+    if (map == MAP_FAILED)
+        return false;
+    q->map = map;
+    q->arena = (uint32_t *) ((char *) map + sizeof(pq_header_t));
+    q->cap = cap;
+    return true;
+}
+
+/* Make room for words more words, growing the file geometrically */
+static bool pq_reserve(pqueue_t *q, uint64_t words)
+{
+    uint64_t need = (uint64_t) header_of(q)->used + words;
+    if (need <= q->cap)
+        return true;
+    if (need > UINT32_MAX)
+        return false;
+
+    uint64_t cap = q->cap;
+    while (cap < need)
+        cap *= 2;
+    if (cap > UINT32_MAX)
+        cap = UINT32_MAX;
+    if (ftruncate(q->fd, file_size(cap)))
+        return false;
+    void *map = mremap(q->map, file_size(q->cap), file_size(cap),
+                       MREMAP_MAYMOVE);
+    if (map == MAP_FAILED)
+        return false;
+    q->map = map;
+    q->arena = (uint32_t *) ((char *) map + sizeof(pq_header_t));
+    q->cap = cap;
+    return true;
+}
+
+/* Rebuild the backward links and counters from the forward chain, checking
+ * that it stays within the used words and every string is terminated.
+ */
+static bool pq_recover(pqueue_t *q)
+{
+    pq_header_t *h = header_of(q);
+    uint32_t used = h->used, live = PQ_HEAD_WORDS, size = 0, prev = 0;
+    for (uint32_t i = FWD(q, 0); i; i = FWD(q, i)) {
+        if (i < PQ_HEAD_WORDS || i > used - PQ_HEAD_WORDS - 1 ||
+            size > used / (PQ_HEAD_WORDS + 1))
+            return false;
+        const char *s = NODE_VALUE(q->arena, i);
+        size_t room = (size_t) (used - i - PQ_HEAD_WORDS) * sizeof(uint32_t);
+        if (!memchr(s, '\0', room))
+            return false;
+        BWD(q, i) = prev;
+        prev = i;
+        live += node_words(strlen(s));
+        size++;
+    }
+    BWD(q, 0) = prev;
+    q->size = size;
+    q->garbage = used - live;
+    return true;
+}
+
+/* Open a persistent queue, creating an empty one if needed */
+pqueue_t *pq_open(const char *path)
+{
+    if (!path)
+        return NULL;
+    pqueue_t *q = calloc(1, sizeof(pqueue_t));
+    if (!q)
+        return NULL;
+    q->path = strdup(path);
+    q->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (!q->path || q->fd < 0)
+        goto fail;
+
+    struct stat st;
+    if (fstat(q->fd, &st))
+        goto fail;
+    size_t size = st.st_size;
+    if (size < file_size(PQ_MIN_CAP)) {
+        /* A file killed while being created is still all zeros */
+        if (size && size != file_size(PQ_MIN_CAP))
+            goto fail;
+        if (!size && ftruncate(q->fd, file_size(PQ_MIN_CAP)))
+            goto fail;
+        size = file_size(PQ_MIN_CAP);
+    }
+    if ((size - sizeof(pq_header_t)) % sizeof(uint32_t) ||
+        (size - sizeof(pq_header_t)) / sizeof(uint32_t) > UINT32_MAX)
+        goto fail;
+    if (!pq_map(q, (size - sizeof(pq_header_t)) / sizeof(uint32_t)))
+        goto fail;
+
+    pq_header_t *h = header_of(q);
+    if (!h->magic) {
+        memset(h, 0, sizeof(*h));
+        h->version = PQ_VERSION;
+        h->used = PQ_HEAD_WORDS;
+        q->arena[0] = q->arena[1] = 0;
+        COMMIT(h->magic, PQ_MAGIC);
+    }
+    if (h->magic != PQ_MAGIC || h->version != PQ_VERSION || h->dir > 1 ||
+        h->used < PQ_HEAD_WORDS || h->used > q->cap || !pq_recover(q)) {
+        munmap(q->map, file_size(q->cap));
+        goto fail;
+    }
+    return q;
+
+fail:
+    if (q->fd >= 0)
+        close(q->fd);
+    free(q->path);
+    free(q);
+    return NULL;
+}
+
+/* Write all changes to the file */
+bool pq_sync(pqueue_t *q)
+{
+    if (!q)
+        return false;
+    q->pending = 0;
+    return !msync(q->map, file_size(q->cap), MS_SYNC);
+}
+
+/* Sync and close a queue, freeing its memory */
+bool pq_close(pqueue_t *q)
+{
+    if (!q)
+        return true;
+    bool ok = pq_sync(q);
+    munmap(q->map, file_size(q->cap));
+    if (close(q->fd))
+        ok = false;
+    free(q->path);
+    free(q);
+    return ok;
+}
+
+/* Call pq_sync() automatically every n operations */
+void pq_set_sync_batch(pqueue_t *q, uint32_t n)
+{
+    if (q)
+        q->batch = n;
+}
+
+static void pq_done(pqueue_t *q)
+{
+    if (q->batch && ++q->pending >= q->batch)
+        pq_sync(q);
+}
+
+/* Get the index of the first node of queue */
+uint32_t pq_first(const pqueue_t *q)
+{
+    return FWD(q, 0);
+}
+
+/* Get the index of the node following node i */
+uint32_t pq_next(const pqueue_t *q, uint32_t i)
+{
+    return FWD(q, i);
+}
+
+/* Link node i in front of node next, which is 0 for the tail */
+static void node_link(pqueue_t *q, uint32_t i, uint32_t next)
+{
+    uint32_t prev = BWD(q, next);
+    FWD(q, i) = next;
+    BWD(q, i) = prev;
+    COMMIT(FWD(q, prev), i);
+    BWD(q, next) = i;
+}
+
+static bool pq_insert(pqueue_t *q, const char *s, bool tail)
+{
+    if (!q || !s)
+        return false;
+
+    size_t len = strlen(s);
+    uint64_t words = node_words(len);
+    if (!pq_reserve(q, words))
+        return false;
+
+    /* The node is written past the used words before they cover it */
+    pq_header_t *h = header_of(q);
+    uint32_t i = h->used;
+    memcpy(NODE_VALUE(q->arena, i), s, len + 1);
+    COMMIT(h->used, (uint32_t) (i + words));
+
+    node_link(q, i, tail ? 0 : FWD(q, 0));
+    q->size++;
+    pq_done(q);
+    return true;
+}
+
+/* Insert a copy of string s at head of queue */
+bool pq_insert_head(pqueue_t *q, const char *s)
+{
+    return pq_insert(q, s, false);
+}
+
+/* Insert a copy of string s at tail of queue */
+bool pq_insert_tail(pqueue_t *q, const char *s)
+{
+    return pq_insert(q, s, true);
+}
+
+/* Rewrite the queue into a new file in list order, then swap it in */
+static void pq_compact(pqueue_t *q)
+{
+    size_t len = strlen(q->path);
+    char *tmp = malloc(len + sizeof(".tmp"));
+    if (!tmp)
+        return;
+    memcpy(tmp, q->path, len);
+    memcpy(tmp + len, ".tmp", sizeof(".tmp"));
+
+    pqueue_t n = {.fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644)};
+    uint64_t cap = PQ_MIN_CAP;
+    while (cap < 2 * (uint64_t) (header_of(q)->used - q->garbage))
+        cap *= 2;
+    if (cap > UINT32_MAX)
+        cap = UINT32_MAX;
+    if (n.fd < 0 || ftruncate(n.fd, file_size(cap)) || !pq_map(&n, cap)) {
+        if (n.fd >= 0) {
+            close(n.fd);
+            unlink(tmp);
+        }
+        free(tmp);
+        return;
+    }
+
+    pq_header_t *h = header_of(&n);
+    uint32_t used = PQ_HEAD_WORDS, prev = 0;
+    for (uint32_t i = FWD(q, 0); i; i = FWD(q, i)) {
+        size_t slen = strlen(NODE_VALUE(q->arena, i));
+        memcpy(NODE_VALUE(n.arena, used), NODE_VALUE(q->arena, i), slen + 1);
+        n.arena[prev] = used;
+        n.arena[used + 1] = prev;
+        prev = used;
+        used += node_words(slen);
+    }
+    n.arena[prev] = 0;
+    n.arena[1] = prev;
+    h->version = PQ_VERSION;
+    h->used = used;
+    h->magic = PQ_MAGIC;
+
+    /* The new file has to be complete on disk before it replaces the old */
+    if (msync(n.map, file_size(cap), MS_SYNC) || rename(tmp, q->path)) {
+        munmap(n.map, file_size(cap));
+        close(n.fd);
+        unlink(tmp);
+        free(tmp);
+        return;
+    }
+    free(tmp);
+
+    munmap(q->map, file_size(q->cap));
+    close(q->fd);
+    q->map = n.map;
+    q->arena = n.arena;
+    q->cap = n.cap;
+    q->fd = n.fd;
+    q->garbage = 0;
+    q->pending = 0;
+}
+
+static bool pq_remove(pqueue_t *q, char *sp, size_t bufsize, bool tail)
+{
+    if (!q || !q->size)
+        return false;
+
+    uint32_t i = tail ? BWD(q, 0) : FWD(q, 0);
+    uint32_t prev = BWD(q, i), next = FWD(q, i);
+    COMMIT(FWD(q, prev), next);
+    BWD(q, next) = prev;
+
+    const char *value = NODE_VALUE(q->arena, i);
+    size_t len = strlen(value);
+    if (sp && bufsize) {
+        size_t n = len < bufsize - 1 ? len : bufsize - 1;
+        memcpy(sp, value, n);
+        sp[n] = '\0';
+    }
+
+    q->size--;
+    q->garbage += node_words(len);
+    uint32_t used = header_of(q)->used;
+    if (used >= PQ_COMPACT_MIN && q->garbage > used / 2)
+        pq_compact(q);
+    pq_done(q);
+    return true;
+}
+
+/* Remove the element from head of queue */
+bool pq_remove_head(pqueue_t *q, char *sp, size_t bufsize)
+{
+    return pq_remove(q, sp, bufsize, false);
+}
+
+/* Remove the element from tail of queue */
+bool pq_remove_tail(pqueue_t *q, char *sp, size_t bufsize)
+{
+    return pq_remove(q, sp, bufsize, true);
+}
+
+/* Reverse elements in queue */
+void pq_reverse(pqueue_t *q)
+{
+    if (!q || q->size < 2)
+        return;
+
+    pq_header_t *h = header_of(q);
+    COMMIT(h->dir, 1 - h->dir);
+    pq_done(q);
+}
+
+/* Merge two 0-terminated runs chained through their backward words */
+static uint32_t merge_runs(pqueue_t *q, uint32_t a, uint32_t b, bool descend)
+{
+    uint32_t head = 0, *tail = &head;
+    while (a && b) {
+        int cmp = strcmp(NODE_VALUE(q->arena, a), NODE_VALUE(q->arena, b));
+        if (descend ? cmp >= 0 : cmp <= 0) {
+            *tail = a;
+            tail = &BWD(q, a);
+            a = *tail;
+        } else {
+            *tail = b;
+            tail = &BWD(q, b);
+            b = *tail;
+        }
+    }
+    *tail = a ? a : b;
+    return head;
+}
+
+/* Sort elements of queue in ascending/descending order */
+void pq_sort(pqueue_t *q, bool descend)
+{
+    if (!q || q->size < 2)
+        return;
+
+    /* The new order is built in the backward words, leaving the forward
+     * chain intact until the direction flips over to it.
+     */
+    uint32_t pending[32] = {0};
+    for (uint32_t i = FWD(q, 0), next; i; i = next) {
+        next = FWD(q, i);
+        BWD(q, i) = 0;
+
+        uint32_t run = i;
+        int k = 0;
+        for (; pending[k]; k++) {
+            run = merge_runs(q, pending[k], run, descend);
+            pending[k] = 0;
+        }
+        pending[k] = run;
+    }
+
+    uint32_t run = 0;
+    for (int k = 0; k < 32; k++) {
+        if (pending[k])
+            run = run ? merge_runs(q, pending[k], run, descend) : pending[k];
+    }
+    BWD(q, 0) = run;
+
+    pq_header_t *h = header_of(q);
+    COMMIT(h->dir, 1 - h->dir);
+
+    uint32_t prev = 0;
+    for (uint32_t i = run; i; i = FWD(q, i)) {
+        BWD(q, i) = prev;
+        prev = i;
+    }
+    BWD(q, 0) = prev;
+    pq_done(q);
+}
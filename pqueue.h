@@ -0,0 +1,181 @@
+#ifndef LAB0_PQUEUE_H
+#define LAB0_PQUEUE_H
+
+/* A persistent variant of iqueue.h, living in a file mapped into memory.
+ *
+ * Nodes are laid out as in iqueue.h: two 32-bit word indices followed by the
+ * string, with the head at index 0, so the file means the same wherever it
+ * is mapped. Which of the two words links forward is selected by a bit in
+ * the file header; the other one links backward.
+ *
+ * Every operation reaches its new state with a single aligned store: insert
+ * and remove rewrite one forward link, sort builds the new order in the
+ * backward links and reverse uses them as they are, both finishing by
+ * flipping the direction bit. The forward chain is thus always a complete
+ * queue, and pq_open() rebuilds the backward links and counters from it.
+ * A process killed at any point leaves a queue holding the effect of every
+ * operation completed, and of the interrupted one or not.
+ *
+ * Changes reach the file at the latest with pq_sync(), which is called
+ * automatically every pq_set_sync_batch() operations. Surviving a power loss
+ * is only guaranteed for the state of the last pq_sync().
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * pqueue_t - Queue stored in a memory-mapped file
+ * @map: the whole file, the header followed by the node words
+ * @arena: node words, following the header in @map
+ * @cap: number of node words the file has room for
+ * @size: number of elements
+ * @garbage: number of words in holes left by removed nodes
+ * @pending: operations since the last pq_sync()
+ * @batch: operations between automatic calls to pq_sync(), 0 for none
+ * @fd: descriptor of the file
+ * @path: name of the file, to replace it when compacting
+ */
+typedef struct {
+    void *map;
+    uint32_t *arena;
+    uint32_t cap;
+    uint32_t size;
+    uint32_t garbage;
+    uint32_t pending;
+    uint32_t batch;
+    int fd;
+    char *path;
+} pqueue_t;
+
+/**
+ * pq_open() - Open a persistent queue, creating an empty one if needed
+ * @path: name of the file holding the queue
+ *
+ * An existing file is checked and recovered from an interrupted operation.
+ *
+ * Return: the queue, or NULL if the file could not be opened or mapped, is
+ * not a queue, or allocation failed
+ */
+pqueue_t *pq_open(const char *path);
+
+/**
+ * pq_close() - Sync and close a queue, freeing its memory
+ * @q: queue to be closed, which may be NULL
+ *
+ * Return: true if all changes reached the file, false otherwise
+ */
+bool pq_close(pqueue_t *q);
+
+/**
+ * pq_sync() - Write all changes to the file
+ * @q: queue to be synced
+ *
+ * Return: true for success, false if msync() failed or queue is NULL
+ */
+bool pq_sync(pqueue_t *q);
+
+/**
+ * pq_set_sync_batch() - Call pq_sync() automatically every n operations
+ * @q: queue to be configured
+ * @n: number of operations between syncs, 0 to only sync explicitly
+ */
+void pq_set_sync_batch(pqueue_t *q, uint32_t n);
+
+/**
+ * pq_insert_head() - Insert a copy of string s at head of queue
+ * @q: queue to insert into
+ * @s: string to be copied into the file
+ *
+ * Return: true for success, false if the file could not grow or queue is NULL
+ */
+bool pq_insert_head(pqueue_t *q, const char *s);
+
+/**
+ * pq_insert_tail() - Insert a copy of string s at tail of queue
+ * @q: queue to insert into
+ * @s: string to be copied into the file
+ *
+ * Return: true for success, false if the file could not grow or queue is NULL
+ */
+bool pq_insert_tail(pqueue_t *q, const char *s);
+
+/**
+ * pq_remove_head() - Remove the element from head of queue
+ * @q: queue to remove from
+ * @sp: output buffer where the removed string is copied, or NULL
+ * @bufsize: size of the string buffer
+ *
+ * Return: true for success, false if queue is NULL or empty.
+ */
+bool pq_remove_head(pqueue_t *q, char *sp, size_t bufsize);
+
+/**
+ * pq_remove_tail() - Remove the element from tail of queue
+ * @q: queue to remove from
+ * @sp: output buffer where the removed string is copied, or NULL
+ * @bufsize: size of the string buffer
+ *
+ * Return: true for success, false if queue is NULL or empty.
+ */
+bool pq_remove_tail(pqueue_t *q, char *sp, size_t bufsize);
+
+/**
+ * pq_size() - Get the number of elements in queue
+ * @q: queue to be examined
+ *
+ * Return: the number of elements in queue, zero if queue is NULL or empty
+ */
+static inline uint32_t pq_size(const pqueue_t *q)
+{
+    return q ? q->size : 0;
+}
+
+/**
+ * pq_first() - Get the index of the first node of queue
+ * @q: queue to be examined
+ *
+ * Return: the index of the first node, 0 if queue is empty
+ */
+uint32_t pq_first(const pqueue_t *q);
+
+/**
+ * pq_next() - Get the index of the node following node i
+ * @q: queue holding node i
+ * @i: index of a node
+ *
+ * Return: the index of the next node, 0 at the end of queue
+ */
+uint32_t pq_next(const pqueue_t *q, uint32_t i);
+
+/**
+ * pq_value() - Get the string held by node i
+ * @q: queue holding node i
+ * @i: index of a node, not 0
+ *
+ * Return: the string, valid until the next operation changing the queue
+ */
+static inline const char *pq_value(const pqueue_t *q, uint32_t i)
+{
+    return (const char *) &q->arena[i + 2];
+}
+
+/**
+ * pq_reverse() - Reverse elements in queue
+ * @q: queue to be reversed
+ *
+ * This takes O(1) time, the backward links becoming the forward ones.
+ */
+void pq_reverse(pqueue_t *q);
+
+/**
+ * pq_sort() - Sort elements of queue in ascending/descending order
+ * @q: queue to be sorted
+ * @descend: whether to sort in descending order
+ *
+ * The sort is stable and works on the links only.
+ */
+void pq_sort(pqueue_t *q, bool descend);
+
+#endif /* LAB0_PQUEUE_H */
@@ -1,5 +1,9 @@
 /* Implementation of testing code for queue code */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* dl_iterate_phdr */
+#endif
+
 #include <assert.h>
 #include <errno.h>
 #include <getopt.h>
@@ -19,6 +23,10 @@
 #include <time.h>
 #endif
 
+#if defined(__linux__)
+#include <link.h>
+#endif
+
 #include "dudect/fixture.h"
 #include "list.h"
 #include "random.h"
@@ -53,7 +61,6 @@ extern int show_entropy;
 
 /* How large is a queue before it's considered big.
  * This affects how it gets printed
- * and whether cautious mode is used when freeing the queue
  */
 #define BIG_LIST_SIZE 30
 
@@ -75,6 +82,24 @@ static int string_length = MAXSTRING;
 
 static int descend = 0;
 
+/* Maintain an order-statistics index in newly created queues */
+static int use_index = 0;
+
+/* Create queues of the sorted kind */
+static int use_sorted = 0;
+
+/* Share equal strings between elements of newly created queues */
+static int use_intern = 0;
+
+/* Keep a hash index of values in newly created queues */
+static int use_hash = 0;
+
+/* Reverse newly created queues by flipping a direction flag */
+static int use_lazy = 0;
+
+/* Memory budget in bytes of the strings sorted at once by 'fsort' */
+static int sort_budget = 16 << 20;
+
 #define MIN_RANDSTR_LEN 5
 #define MAX_RANDSTR_LEN 10
 static const char charset[] = "abcdefghijklmnopqrstuvwxyz";
@@ -82,7 +107,9 @@ static const char charset[] = "abcdefghijklmnopqrstuvwxyz";
 typedef enum {
     POS_TAIL,
     POS_HEAD,
+    POS_SORTED,
 } position_t;
+static const char *position_name[] = {"tail", "head", "sorted"};
 /* Forward declarations */
 static bool q_show(int vlevel);
 
@@ -101,9 +128,6 @@ static bool do_free(int argc, char *argv[])
     }
     error_check();
 
-    if (current && current->size > BIG_LIST_SIZE)
-        set_cautious_mode(false);
-
     struct list_head *qnext = NULL;
     if (chain.size > 1) {
         qnext = (current->chain.next == &chain.head) ? chain.head.next
@@ -116,7 +140,6 @@ static bool do_free(int argc, char *argv[])
         if (exception_setup(true))
             q_free(current->q);
         exception_cancel();
-        set_cautious_mode(true);
     }
 
     if (current) {
@@ -134,6 +157,8 @@ static bool do_free(int argc, char *argv[])
                bcnt);
         ok = false;
     }
+    if (!chain.size)
+        harness_reset(0);
 
     return ok && !error_check();
 }
@@ -154,6 +179,11 @@ static bool do_new(int argc, char *argv[])
         qctx->size = 0;
         qctx->q = q_new();
         qctx->id = chain.size++;
+        q_set_mode(qctx->q, (use_index ? Q_MODE_INDEX : 0) |
+                                (use_sorted ? Q_MODE_SORTED : 0) |
+                                (use_intern ? Q_MODE_INTERN : 0) |
+                                (use_hash ? Q_MODE_HASH : 0) |
+                                (use_lazy ? Q_MODE_LAZY_REVERSE : 0));
 
         current = qctx;
     }
@@ -223,21 +253,29 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
 
     if (!current || !current->q)
         report(3, "Warning: Calling insert %s on null queue",
-               pos == POS_TAIL ? "tail" : "head");
+               position_name[pos]);
     error_check();
 
     if (current && exception_setup(true)) {
         for (int r = 0; ok && r < reps; r++) {
             if (need_rand)
                 fill_rand_string(randstr_buf, sizeof(randstr_buf));
-            bool rval = pos == POS_TAIL ? q_insert_tail(current->q, inserts)
-                                        : q_insert_head(current->q, inserts);
-            if (rval) {
+            bool rval;
+            if (pos == POS_SORTED)
+                rval = q_insert_sorted(current->q, inserts);
+            else
+                rval = pos == POS_TAIL ? q_insert_tail(current->q, inserts)
+                                       : q_insert_head(current->q, inserts);
+            if (rval && pos == POS_SORTED) {
+                /* Order is checked once the whole batch is in */
                 current->size++;
+            } else if (rval) {
+                current->size++;
+                /* The head of a lazily reversed queue is the list tail */
+                bool at_tail = (pos == POS_TAIL) != q_is_reversed(current->q);
                 element_t *entry =
-                    pos == POS_TAIL
-                        ? list_last_entry(current->q, element_t, list)
-                        : list_first_entry(current->q, element_t, list);
+                    at_tail ? list_last_entry(current->q, element_t, list)
+                            : list_first_entry(current->q, element_t, list);
                 char *cur_inserts = entry->value;
                 if (!cur_inserts) {
                     report(1, "ERROR: Failed to save copy of string in queue");
@@ -248,7 +286,8 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
                            "queue element");
                     ok = false;
                     break;
-                } else if (r == 1 && lasts == cur_inserts) {
+                } else if (r == 1 && lasts == cur_inserts &&
+                           !(q_get_mode(current->q) & Q_MODE_INTERN)) {
                     report(1,
                            "ERROR: Need to allocate separate string for each "
                            "queue element");
@@ -272,6 +311,19 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
     }
     exception_cancel();
 
+    if (ok && current && pos == POS_SORTED) {
+        struct list_head *cur;
+        list_for_each (cur, current->q) {
+            if (cur->next != current->q &&
+                strcmp(list_entry(cur, element_t, list)->value,
+                       list_entry(cur->next, element_t, list)->value) > 0) {
+                report(1, "ERROR: Not sorted in ascending order");
+                ok = false;
+                break;
+            }
+        }
+    }
+
     q_show(3);
     return ok;
 }
@@ -288,6 +340,16 @@ static bool do_it(int argc, char *argv[])
     return queue_insert(POS_TAIL, argc, argv);
 }
 
+/* insert in ascending order */
+static bool do_is(int argc, char *argv[])
+{
+    if (simulation) {
+        report(1, "%s is not supported in simulation mode", argv[0]);
+        return false;
+    }
+    return queue_insert(POS_SORTED, argc, argv);
+}
+
 static bool queue_remove(position_t pos, int argc, char *argv[])
 {
     /* FIXME: It is known that both functions is_remove_tail_const() and
@@ -512,6 +574,123 @@ static bool do_dedup(int argc, char *argv[])
     return ok && !error_check();
 }
 
+typedef struct {
+    char *value;
+    int idx;
+} value_pos_t;
+
+static int cmp_value_pos(const void *a, const void *b)
+{
+    const value_pos_t *x = a, *y = b;
+    int r = strcmp(x->value, y->value);
+    return r ? r : x->idx - y->idx;
+}
+
+static int cmp_value_pos_desc(const void *a, const void *b)
+{
+    const value_pos_t *x = a, *y = b;
+    int r = strcmp(y->value, x->value);
+    return r ? r : x->idx - y->idx;
+}
+
+static bool do_hdedup(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Try to access null queue");
+        return false;
+    }
+
+    /* Save the values in queue order, then sort a copy to find which values
+     * occur exactly once; those are the ones expected to survive.
+     */
+    int n = current->size;
+    value_pos_t *vals = malloc(sizeof(value_pos_t) * (n ? n : 1));
+    bool *keep = malloc(sizeof(bool) * (n ? n : 1));
+    char **order = malloc(sizeof(char *) * (n ? n : 1));
+    if (!vals || !keep || !order) {
+        free(vals);
+        free(keep);
+        free(order);
+        report(1,
+               "INTERNAL ERROR.  Could not allocate space for duplicate "
+               "checking");
+        return false;
+    }
+
+    int cnt = 0;
+    bool copied = true;
+    element_t *item;
+    list_for_each_entry (item, current->q, list) {
+        if (cnt == n)
+            break;
+        vals[cnt].value = order[cnt] = strdup(item->value);
+        if (!(copied = order[cnt]))
+            break;
+        vals[cnt].idx = cnt;
+        cnt++;
+    }
+    if (!copied) {
+        for (int i = 0; i < cnt; i++)
+            free(order[i]);
+        free(vals);
+        free(keep);
+        free(order);
+        report(1,
+               "INTERNAL ERROR.  Could not allocate space for duplicate "
+               "checking");
+        return false;
+    }
+    qsort(vals, cnt, sizeof(value_pos_t), cmp_value_pos);
+    for (int i = 0; i < cnt; i++) {
+        keep[vals[i].idx] =
+            (i == 0 || strcmp(vals[i - 1].value, vals[i].value)) &&
+            (i == cnt - 1 || strcmp(vals[i].value, vals[i + 1].value));
+    }
+
+    error_check();
+    bool ok = true;
+    if (exception_setup(true))
+        ok = q_delete_dup_unsorted(current->q);
+    exception_cancel();
+
+    if (!ok) {
+        report(1, "ERROR: Calling delete duplicate on null or empty queue");
+    } else {
+        struct list_head *cur = current->q->next;
+        for (int i = 0; i < cnt; i++)
+            current->size -= !keep[i];
+        for (int i = 0; i < cnt; i++) {
+            if (!keep[i])
+                continue;
+            if (cur == current->q ||
+                strcmp(list_entry(cur, element_t, list)->value, order[i])) {
+                ok = false;
+                break;
+            }
+            cur = cur->next;
+        }
+        ok = ok && cur == current->q;
+        if (!ok)
+            report(1,
+                   "ERROR: Duplicate strings are in queue or distinct strings "
+                   "are not in queue in their original order");
+    }
+
+    for (int i = 0; i < cnt; i++)
+        free(order[i]);
+    free(vals);
+    free(keep);
+    free(order);
+
+    q_show(3);
+    return ok && !error_check();
+}
+
 static bool do_reverse(int argc, char *argv[])
 {
     if (argc != 1) {
@@ -603,9 +782,14 @@ bool do_sort(int argc, char *argv[])
     struct list_head *nodes[MAX_NODES];
     unsigned no = 0;
     if (current && current->size && current->size <= MAX_NODES) {
-        element_t *entry;
-        list_for_each_entry(entry, current->q, list)
-            nodes[no++] = &entry->list;
+        struct list_head *cur;
+        if (q_is_reversed(current->q)) {
+            for (cur = current->q->prev; cur != current->q; cur = cur->prev)
+                nodes[no++] = cur;
+        } else {
+            list_for_each (cur, current->q)
+                nodes[no++] = cur;
+        }
     } else if (current && current->size > MAX_NODES)
         report(1,
                "Warning: Skip checking the stability of the sort because the "
@@ -693,10 +877,32 @@ static bool do_dm(int argc, char *argv[])
     return ok && !error_check();
 }
 
-static bool do_swap(int argc, char *argv[])
+/* Logical successor of node in the current queue */
+static struct list_head *queue_next(const struct list_head *node)
 {
-    if (argc != 1) {
-        report(1, "%s takes no arguments", argv[0]);
+    return q_is_reversed(current->q) ? node->prev : node->next;
+}
+
+/* Walk the current queue to find the element at pos, for cross-checking */
+static element_t *queue_entry_at(int pos)
+{
+    for (struct list_head *cur = queue_next(current->q); cur != current->q;
+         cur = queue_next(cur)) {
+        if (!pos--)
+            return list_entry(cur, element_t, list);
+    }
+    return NULL;
+}
+
+static bool do_get(int argc, char *argv[])
+{
+    int pos;
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+    if (!get_int(argv[1], &pos)) {
+        report(1, "Invalid position '%s'", argv[1]);
         return false;
     }
 
@@ -706,213 +912,1205 @@ static bool do_swap(int argc, char *argv[])
     }
     error_check();
 
-    set_noallocate_mode(true);
+    element_t *e = NULL;
     if (exception_setup(true))
-        q_swap(current->q);
+        e = q_get(current->q, pos);
     exception_cancel();
 
-    set_noallocate_mode(false);
+    bool ok = true;
+    element_t *expect = pos >= 0 ? queue_entry_at(pos) : NULL;
+    if (e != expect) {
+        report(1, "ERROR: Element at position %d should be %s, but got %s",
+               pos, expect ? expect->value : "NULL", e ? e->value : "NULL");
+        ok = false;
+    } else if (e) {
+        report(2, "Element at position %d = %s", pos, e->value);
+    } else {
+        report(2, "Position %d is out of range", pos);
+    }
 
-    q_show(3);
-    return !error_check();
+    return ok && !error_check();
 }
 
-
-static bool do_ascend(int argc, char *argv[])
+static bool do_ia(int argc, char *argv[])
 {
-    if (argc != 1) {
-        report(1, "%s takes too much arguments", argv[0]);
+    int pos;
+    if (argc != 3) {
+        report(1, "%s needs 2 arguments", argv[0]);
+        return false;
+    }
+    if (!get_int(argv[2], &pos)) {
+        report(1, "Invalid position '%s'", argv[2]);
         return false;
     }
 
     if (!current || !current->q) {
-        report(3, "Warning: Calling ascend on null queue");
+        report(3, "Warning: Try to access null queue");
         return false;
     }
     error_check();
 
-
-    int cnt = q_size(current->q);
-    if (!cnt)
-        report(3, "Warning: Calling ascend on empty queue");
-    else if (cnt < 2)
-        report(3, "Warning: Calling ascend on single node");
-    error_check();
-
+    bool ok = false;
     if (exception_setup(true))
-        current->size = q_ascend(current->q);
-    set_noallocate_mode(false);
-
-    bool ok = true;
+        ok = q_insert_at(current->q, pos, argv[1]);
+    exception_cancel();
 
-    cnt = current->size;
-    if (current->size) {
-        for (struct list_head *cur_l = current->q->next;
-             cur_l != current->q && --cnt; cur_l = cur_l->next) {
-            element_t *item, *next_item;
-            item = list_entry(cur_l, element_t, list);
-            next_item = list_entry(cur_l->next, element_t, list);
-            if (strcmp(item->value, next_item->value) > 0) {
-                report(1,
-                       "ERROR: At least one node violated the ordering rule");
-                ok = false;
-                break;
-            }
+    if (ok) {
+        current->size++;
+        element_t *e = queue_entry_at(pos);
+        if (!e || !e->value || strcmp(e->value, argv[1])) {
+            report(1, "ERROR: Position %d does not hold inserted string %s",
+                   pos, argv[1]);
+            ok = false;
+        } else if (e->value == argv[1]) {
+            report(1,
+                   "ERROR: Need to allocate and copy string for new queue "
+                   "element");
+            ok = false;
+        }
+    } else if (pos >= 0 && pos <= current->size) {
+        fail_count++;
+        if (fail_count < fail_limit) {
+            report(2, "Insertion of %s failed", argv[1]);
+            ok = true;
+        } else {
+            report(1, "ERROR: Insertion of %s failed (%d failures total)",
+                   argv[1], fail_count);
         }
+    } else {
+        report(2, "Position %d is out of range", pos);
+        ok = true;
     }
 
     q_show(3);
     return ok && !error_check();
 }
 
-static bool do_descend(int argc, char *argv[])
+static bool do_da(int argc, char *argv[])
 {
-    if (argc != 1) {
-        report(1, "%s takes too much arguments", argv[0]);
+    int pos;
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+    if (!get_int(argv[1], &pos)) {
+        report(1, "Invalid position '%s'", argv[1]);
         return false;
     }
 
     if (!current || !current->q) {
-        report(3, "Warning: Calling descend on null queue");
+        report(3, "Warning: Try to access null queue");
         return false;
     }
     error_check();
 
+    bool in_range = pos >= 0 && pos < current->size;
+    /* The successor has to slide into the deleted position */
+    element_t *succ = in_range ? queue_entry_at(pos + 1) : NULL;
 
-    int cnt = q_size(current->q);
-    if (!cnt)
-        report(3, "Warning: Calling descend on empty queue");
-    else if (cnt < 2)
-        report(3, "Warning: Calling descend on single node");
-    error_check();
-
+    bool ok = false;
     if (exception_setup(true))
-        current->size = q_descend(current->q);
-    set_noallocate_mode(false);
-
-    bool ok = true;
+        ok = q_delete_at(current->q, pos);
+    exception_cancel();
 
-    cnt = current->size;
-    if (current->size) {
-        for (struct list_head *cur_l = current->q->next;
-             cur_l != current->q && --cnt; cur_l = cur_l->next) {
-            element_t *item, *next_item;
-            item = list_entry(cur_l, element_t, list);
-            next_item = list_entry(cur_l->next, element_t, list);
-            if (strcmp(item->value, next_item->value) < 0) {
-                report(1,
-                       "ERROR: At least one node violated the ordering rule");
-                ok = false;
-                break;
-            }
+    if (ok != in_range) {
+        report(1, "ERROR: Deleting position %d of %d elements should %s", pos,
+               current->size, in_range ? "succeed" : "fail");
+        ok = false;
+    } else if (in_range) {
+        current->size--;
+        if (queue_entry_at(pos) != succ) {
+            report(1, "ERROR: Deleted the wrong node at position %d", pos);
+            ok = false;
         }
+    } else {
+        report(2, "Position %d is out of range", pos);
+        ok = true;
     }
 
     q_show(3);
     return ok && !error_check();
 }
 
-static bool do_reverseK(int argc, char *argv[])
+/* First element holding s, found by walking the list */
+static element_t *queue_entry_of(const char *s)
 {
-    int k = 0;
+    for (struct list_head *cur = queue_next(current->q); cur != current->q;
+         cur = queue_next(cur)) {
+        element_t *e = list_entry(cur, element_t, list);
+        if (!strcmp(e->value, s))
+            return e;
+    }
+    return NULL;
+}
 
-    if (!current || !current->q) {
-        report(3, "Warning: Calling reverseK on null queue");
+static bool do_find(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
         return false;
     }
-    error_check();
 
-    if (argc == 2) {
-        if (!get_int(argv[1], &k)) {
-            report(1, "Invalid number of K");
-            return false;
-        }
-    } else {
-        report(1, "Invalid number of arguments for reverseK");
+    if (!current || !current->q) {
+        report(3, "Warning: Try to access null queue");
         return false;
     }
+    error_check();
 
-    set_noallocate_mode(true);
+    element_t *e = NULL;
     if (exception_setup(true))
-        q_reverseK(current->q, k);
+        e = q_find(current->q, argv[1]);
     exception_cancel();
 
-    set_noallocate_mode(false);
-    q_show(3);
-    return !error_check();
+    bool ok = true;
+    element_t *expect = queue_entry_of(argv[1]);
+    if (e != expect) {
+        report(1, "ERROR: %s", expect ? "Did not find the first occurrence"
+                                      : "Found a string not in queue");
+        ok = false;
+    } else {
+        report(2, "%s %s in queue", argv[1], e ? "is" : "is not");
+    }
+
+    return ok && !error_check();
 }
 
-static bool do_merge(int argc, char *argv[])
+static bool do_rv(int argc, char *argv[])
 {
-    if (argc != 1) {
-        report(1, "%s takes no arguments", argv[0]);
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
         return false;
     }
 
     if (!current || !current->q) {
-        report(3, "Warning: Calling merge on null queue");
+        report(3, "Warning: Try to access null queue");
         return false;
     }
     error_check();
 
-    int len = 0;
-    set_noallocate_mode(true);
-    if (current && exception_setup(true))
-        len = q_merge(&chain.head, descend);
+    element_t *expect = queue_entry_of(argv[1]);
+    element_t *e = NULL;
+    if (exception_setup(true))
+        e = q_remove_value(current->q, argv[1]);
     exception_cancel();
-    set_noallocate_mode(false);
 
-    if (q_size(&chain.head) > 1) {
-        chain.size = 1;
-        current = list_entry(chain.head.next, queue_contex_t, chain);
-        current->size = len;
+    bool ok = true;
+    if (e != expect) {
+        report(1, "ERROR: %s", expect ? "Did not remove the first occurrence"
+                                      : "Removed a string not in queue");
+        ok = false;
+    } else if (e) {
+        report(2, "Removed %s from queue", argv[1]);
+    } else {
+        report(2, "%s is not in queue", argv[1]);
+    }
 
-        struct list_head *cur = chain.head.next->next;
-        while ((uintptr_t) cur != (uintptr_t) &chain.head) {
-            queue_contex_t *ctx = list_entry(cur, queue_contex_t, chain);
-            cur = cur->next;
-            q_free(ctx->q);
-            free(ctx);
-        }
+    if (e) {
+        current->size--;
+        q_release_element(e);
+    }
 
-        chain.head.prev = &current->chain;
-        current->chain.next = &chain.head;
+    q_show(3);
+    return ok && !error_check();
+}
+
+static bool do_topk(int argc, char *argv[])
+{
+    int k;
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+    if (!get_int(argv[1], &k)) {
+        report(1, "Invalid number '%s'", argv[1]);
+        return false;
     }
 
-    bool ok = true;
-    if (current && current->size) {
-        for (struct list_head *cur_l = current->q->next;
-             cur_l != current->q && --len; cur_l = cur_l->next) {
-            /* Ensure each element in ascending order */
-            element_t *item, *next_item;
-            item = list_entry(cur_l, element_t, list);
-            next_item = list_entry(cur_l->next, element_t, list);
-            if (!descend && strcmp(item->value, next_item->value) > 0) {
-                report(1,
+    if (!current || !current->q) {
+        report(3, "Warning: Try to access null queue");
+        return false;
+    }
+
+    /* A stable sort of the elements tells which ones should come first, the
+     * others are expected to stay in their original order.
+     */
+    int n = current->size;
+    value_pos_t *vals = malloc(sizeof(value_pos_t) * (n ? n : 1));
+    element_t **elems = malloc(sizeof(element_t *) * (n ? n : 1));
+    bool *picked = calloc(n ? n : 1, sizeof(bool));
+    if (!vals || !elems || !picked) {
+        free(vals);
+        free(elems);
+        free(picked);
+        report(1,
+               "INTERNAL ERROR.  Could not allocate space for top-k "
+               "checking");
+        return false;
+    }
+
+    int cnt = 0;
+    for (struct list_head *cur = queue_next(current->q);
+         cur != current->q && cnt < n; cur = queue_next(cur)) {
+        elems[cnt] = list_entry(cur, element_t, list);
+        vals[cnt].value = elems[cnt]->value;
+        vals[cnt].idx = cnt;
+        cnt++;
+    }
+    qsort(vals, cnt, sizeof(value_pos_t),
+          descend ? cmp_value_pos_desc : cmp_value_pos);
+    int winners = k < cnt ? k : cnt;
+    for (int i = 0; i < winners; i++)
+        picked[vals[i].idx] = true;
+
+    error_check();
+    bool ok = false;
+    if (exception_setup(true))
+        ok = q_topk(current->q, k, descend);
+    exception_cancel();
+
+    if (!ok) {
+        if (k >= 0) {
+            report(1, "ERROR: Calling topk on null queue");
+        } else {
+            report(2, "Number %d is out of range", k);
+            ok = true;
+        }
+    } else {
+        struct list_head *cur = queue_next(current->q);
+        for (int i = 0; ok && i < winners; i++, cur = queue_next(cur))
+            ok = cur != current->q &&
+                 list_entry(cur, element_t, list) == elems[vals[i].idx];
+        if (!ok) {
+            report(1, "ERROR: The first %d nodes are not the top %d in order",
+                   winners, winners);
+        } else {
+            for (int i = 0; ok && i < cnt; i++) {
+                if (picked[i])
+                    continue;
+                ok = cur != current->q &&
+                     list_entry(cur, element_t, list) == elems[i];
+                cur = queue_next(cur);
+            }
+            ok = ok && cur == current->q;
+            if (!ok)
+                report(1, "ERROR: The rest of nodes are not in original order");
+        }
+    }
+
+    free(vals);
+    free(elems);
+    free(picked);
+
+    q_show(3);
+    return ok && !error_check();
+}
+
+static int cmp_string(const void *a, const void *b)
+{
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+static bool do_nth(int argc, char *argv[])
+{
+    int n;
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+    if (!get_int(argv[1], &n)) {
+        report(1, "Invalid rank '%s'", argv[1]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Try to access null queue");
+        return false;
+    }
+
+    int cnt = current->size;
+    char **sorted = malloc(sizeof(char *) * (cnt ? cnt : 1));
+    if (!sorted) {
+        report(1, "INTERNAL ERROR.  Could not allocate space for nth checking");
+        return false;
+    }
+    int i = 0;
+    element_t *item;
+    list_for_each_entry (item, current->q, list) {
+        if (i == cnt)
+            break;
+        sorted[i++] = item->value;
+    }
+    qsort(sorted, i, sizeof(char *), cmp_string);
+    const char *expect = n >= 0 && n < i ? sorted[n] : NULL;
+
+    error_check();
+    element_t *e = NULL;
+    set_noallocate_mode(true);
+    if (exception_setup(true))
+        e = q_nth(current->q, n);
+    exception_cancel();
+    set_noallocate_mode(false);
+
+    bool ok = true;
+    if (!expect || !e) {
+        if (expect || e) {
+            report(1, "ERROR: Rank %d should be %s, but got %s", n,
+                   expect ? expect : "out of range", e ? e->value : "NULL");
+            ok = false;
+        } else {
+            report(2, "Rank %d is out of range", n);
+        }
+    } else if (strcmp(e->value, expect)) {
+        report(1, "ERROR: Rank %d should be %s, but got %s", n, expect,
+               e->value);
+        ok = false;
+    } else {
+        /* Walk the list: nothing greater before e, nothing smaller after */
+        int pos = 0, at = -1;
+        for (struct list_head *cur = queue_next(current->q);
+             ok && cur != current->q; cur = queue_next(cur), pos++) {
+            element_t *x = list_entry(cur, element_t, list);
+            if (x == e)
+                at = pos;
+            else if (at < 0 ? strcmp(x->value, expect) > 0
+                            : strcmp(x->value, expect) < 0)
+                ok = false;
+        }
+        if (!ok || at != n || pos != cnt) {
+            report(1, "ERROR: Queue is not partitioned around rank %d", n);
+            ok = false;
+        } else {
+            report(2, "Rank %d = %s", n, e->value);
+        }
+    }
+    free(sorted);
+
+    q_show(3);
+    return ok && !error_check();
+}
+
+static bool do_swap(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Try to access null queue");
+        return false;
+    }
+    error_check();
+
+    set_noallocate_mode(true);
+    if (exception_setup(true))
+        q_swap(current->q);
+    exception_cancel();
+
+    set_noallocate_mode(false);
+
+    q_show(3);
+    return !error_check();
+}
+
+
+static bool do_ascend(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes too much arguments", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling ascend on null queue");
+        return false;
+    }
+    error_check();
+
+
+    int cnt = q_size(current->q);
+    if (!cnt)
+        report(3, "Warning: Calling ascend on empty queue");
+    else if (cnt < 2)
+        report(3, "Warning: Calling ascend on single node");
+    error_check();
+
+    if (exception_setup(true))
+        current->size = q_ascend(current->q);
+    set_noallocate_mode(false);
+
+    bool ok = true;
+
+    cnt = current->size;
+    if (current->size) {
+        for (struct list_head *cur_l = current->q->next;
+             cur_l != current->q && --cnt; cur_l = cur_l->next) {
+            element_t *item, *next_item;
+            item = list_entry(cur_l, element_t, list);
+            next_item = list_entry(cur_l->next, element_t, list);
+            if (strcmp(item->value, next_item->value) > 0) {
+                report(1,
+                       "ERROR: At least one node violated the ordering rule");
+                ok = false;
+                break;
+            }
+        }
+    }
+
+    q_show(3);
+    return ok && !error_check();
+}
+
+static bool do_descend(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes too much arguments", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling descend on null queue");
+        return false;
+    }
+    error_check();
+
+
+    int cnt = q_size(current->q);
+    if (!cnt)
+        report(3, "Warning: Calling descend on empty queue");
+    else if (cnt < 2)
+        report(3, "Warning: Calling descend on single node");
+    error_check();
+
+    if (exception_setup(true))
+        current->size = q_descend(current->q);
+    set_noallocate_mode(false);
+
+    bool ok = true;
+
+    cnt = current->size;
+    if (current->size) {
+        for (struct list_head *cur_l = current->q->next;
+             cur_l != current->q && --cnt; cur_l = cur_l->next) {
+            element_t *item, *next_item;
+            item = list_entry(cur_l, element_t, list);
+            next_item = list_entry(cur_l->next, element_t, list);
+            if (strcmp(item->value, next_item->value) < 0) {
+                report(1,
+                       "ERROR: At least one node violated the ordering rule");
+                ok = false;
+                break;
+            }
+        }
+    }
+
+    q_show(3);
+    return ok && !error_check();
+}
+
+static bool do_reverseK(int argc, char *argv[])
+{
+    int k = 0;
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling reverseK on null queue");
+        return false;
+    }
+    error_check();
+
+    if (argc == 2) {
+        if (!get_int(argv[1], &k)) {
+            report(1, "Invalid number of K");
+            return false;
+        }
+    } else {
+        report(1, "Invalid number of arguments for reverseK");
+        return false;
+    }
+
+    set_noallocate_mode(true);
+    if (exception_setup(true))
+        q_reverseK(current->q, k);
+    exception_cancel();
+
+    set_noallocate_mode(false);
+    q_show(3);
+    return !error_check();
+}
+
+static bool do_merge(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling merge on null queue");
+        return false;
+    }
+    error_check();
+
+    int len = 0;
+    set_noallocate_mode(true);
+    if (current && exception_setup(true))
+        len = q_merge(&chain.head, descend);
+    exception_cancel();
+    set_noallocate_mode(false);
+
+    if (q_size(&chain.head) > 1) {
+        chain.size = 1;
+        current = list_entry(chain.head.next, queue_contex_t, chain);
+        current->size = len;
+
+        struct list_head *cur = chain.head.next->next;
+        while ((uintptr_t) cur != (uintptr_t) &chain.head) {
+            queue_contex_t *ctx = list_entry(cur, queue_contex_t, chain);
+            cur = cur->next;
+            q_free(ctx->q);
+            free(ctx);
+        }
+
+        chain.head.prev = &current->chain;
+        current->chain.next = &chain.head;
+    }
+
+    bool ok = true;
+    if (current && current->size) {
+        for (struct list_head *cur_l = current->q->next;
+             cur_l != current->q && --len; cur_l = cur_l->next) {
+            /* Ensure each element in ascending order */
+            element_t *item, *next_item;
+            item = list_entry(cur_l, element_t, list);
+            next_item = list_entry(cur_l->next, element_t, list);
+            if (!descend && strcmp(item->value, next_item->value) > 0) {
+                report(1,
                        "ERROR: Not sorted in ascending order (It might because "
                        "of unsorted queues are merged or there're some flaws "
                        "in 'q_merge')");
                 ok = false;
                 break;
             }
-
-
-            if (descend && strcmp(item->value, next_item->value) < 0) {
-                report(
-                    1,
-                    "ERROR: Not sorted in descending order (It might because "
-                    "of unsorted queues are merged or there're some flaws "
-                    "in 'q_merge')");
+
+
+            if (descend && strcmp(item->value, next_item->value) < 0) {
+                report(
+                    1,
+                    "ERROR: Not sorted in descending order (It might because "
+                    "of unsorted queues are merged or there're some flaws "
+                    "in 'q_merge')");
+                ok = false;
+                break;
+            }
+        }
+    }
+
+    q_show(3);
+    return ok && !error_check();
+}
+
+typedef enum {
+    SET_UNION,
+    SET_INTERSECT,
+    SET_DIFFERENCE,
+} set_op_t;
+
+/* Copy the strings of queue q, sorted in the current order and deduplicated */
+static char **set_snapshot(struct list_head *q, int size, int *cnt)
+{
+    char **vals = malloc(sizeof(char *) * (size ? size : 1));
+    if (!vals)
+        return NULL;
+
+    int n = 0;
+    for (struct list_head *cur = queue_next(q); cur != q && n < size;
+         cur = queue_next(cur))
+        vals[n++] = strdup(list_entry(cur, element_t, list)->value);
+    qsort(vals, n, sizeof(char *), cmp_string);
+
+    int m = 0;
+    for (int i = 0; i < n; i++) {
+        if (m && !strcmp(vals[m - 1], vals[i]))
+            free(vals[i]);
+        else
+            vals[m++] = vals[i];
+    }
+    if (descend) {
+        for (int i = 0, j = m - 1; i < j; i++, j--) {
+            char *tmp = vals[i];
+            vals[i] = vals[j];
+            vals[j] = tmp;
+        }
+    }
+    *cnt = m;
+    return vals;
+}
+
+static bool do_setop(set_op_t op, int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling %s on null queue", argv[0]);
+        return false;
+    }
+    if (chain.size < 2) {
+        report(3, "Warning: %s needs at least two queues", argv[0]);
+        return false;
+    }
+    error_check();
+
+    /* The second operand is the queue following the current one */
+    struct list_head *qnext = (current->chain.next == &chain.head)
+                                  ? chain.head.next
+                                  : current->chain.next;
+    queue_contex_t *other = list_entry(qnext, queue_contex_t, chain);
+
+    int na, nb;
+    char **va = set_snapshot(current->q, current->size, &na);
+    char **vb = set_snapshot(other->q, other->size, &nb);
+    char **expect = malloc(sizeof(char *) * (na + nb ? na + nb : 1));
+    if (!va || !vb || !expect) {
+        report(1,
+               "INTERNAL ERROR.  Could not allocate space for set operation "
+               "checking");
+        for (int i = 0; va && i < na; i++)
+            free(va[i]);
+        for (int i = 0; vb && i < nb; i++)
+            free(vb[i]);
+        free(va);
+        free(vb);
+        free(expect);
+        return false;
+    }
+
+    int cnt = 0;
+    for (int i = 0, j = 0; i < na || j < nb;) {
+        int cmp = i == na   ? 1
+                  : j == nb ? -1
+                  : descend ? strcmp(vb[j], va[i])
+                            : strcmp(va[i], vb[j]);
+        bool in_a = cmp <= 0, in_b = cmp >= 0;
+        bool keep = op == SET_UNION       ? true
+                    : op == SET_INTERSECT ? in_a && in_b
+                                          : in_a && !in_b;
+        if (keep)
+            expect[cnt++] = in_a ? va[i] : vb[j];
+        i += in_a;
+        j += in_b;
+    }
+
+    int len = 0;
+    if (exception_setup(true)) {
+        switch (op) {
+        case SET_UNION:
+            len = q_union(current->q, other->q, descend);
+            break;
+        case SET_INTERSECT:
+            len = q_intersect(current->q, other->q, descend);
+            break;
+        case SET_DIFFERENCE:
+            len = q_difference(current->q, other->q, descend);
+            break;
+        }
+    }
+    exception_cancel();
+
+    bool ok = true;
+    if (!list_empty(other->q)) {
+        report(1, "ERROR: The second queue is not empty after %s", argv[0]);
+        ok = false;
+    } else {
+        list_del(&other->chain);
+        q_free(other->q);
+        free(other);
+        chain.size--;
+    }
+    current->size = q_size(current->q);
+
+    if (ok && len != cnt) {
+        report(1, "ERROR: Expected %d elements but %s returned %d", cnt,
+               argv[0], len);
+        ok = false;
+    }
+    if (ok) {
+        struct list_head *cur = queue_next(current->q);
+        for (int i = 0; ok && i < cnt; i++, cur = queue_next(cur)) {
+            ok = cur != current->q &&
+                 !strcmp(list_entry(cur, element_t, list)->value, expect[i]);
+        }
+        ok = ok && cur == current->q;
+        if (!ok) {
+            report(1,
+                   "ERROR: Unexpected result of %s (It might because of "
+                   "unsorted queues or there're some flaws in 'q_%s')",
+                   argv[0], argv[0]);
+        }
+    }
+
+    for (int i = 0; i < na; i++)
+        free(va[i]);
+    for (int i = 0; i < nb; i++)
+        free(vb[i]);
+    free(va);
+    free(vb);
+    free(expect);
+
+    q_show(3);
+    return ok && !error_check();
+}
+
+static bool do_union(int argc, char *argv[])
+{
+    return do_setop(SET_UNION, argc, argv);
+}
+
+static bool do_intersect(int argc, char *argv[])
+{
+    return do_setop(SET_INTERSECT, argc, argv);
+}
+
+static bool do_difference(int argc, char *argv[])
+{
+    return do_setop(SET_DIFFERENCE, argc, argv);
+}
+
+static bool do_split(int argc, char *argv[])
+{
+    int k;
+    bool round_robin = false;
+    if (argc != 2 && argc != 3) {
+        report(1, "%s needs 1 or 2 arguments", argv[0]);
+        return false;
+    }
+    if (!get_int(argv[1], &k) || k < 1) {
+        report(1, "Invalid number of parts '%s'", argv[1]);
+        return false;
+    }
+    if (argc == 3) {
+        if (strcmp(argv[2], "rr")) {
+            report(1, "Unknown split method '%s'", argv[2]);
+            return false;
+        }
+        round_robin = true;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling split on null queue");
+        return false;
+    }
+
+    int n = current->size;
+    element_t **elems = malloc(sizeof(element_t *) * (n ? n : 1));
+    struct list_head **parts = malloc(sizeof(struct list_head *) * k);
+    queue_contex_t **ctxs = malloc(sizeof(queue_contex_t *) * k);
+    if (!elems || !parts || !ctxs) {
+        free(elems);
+        free(parts);
+        free(ctxs);
+        report(1, "INTERNAL ERROR.  Could not allocate space for split");
+        return false;
+    }
+
+    int cnt = 0;
+    for (struct list_head *cur = queue_next(current->q);
+         cur != current->q && cnt < n; cur = queue_next(cur))
+        elems[cnt++] = list_entry(cur, element_t, list);
+
+    error_check();
+
+    /* The new queues follow the current one in the chain, in order */
+    bool ok = true;
+    ctxs[0] = current;
+    if (exception_setup(true)) {
+        struct list_head *pos = &current->chain;
+        for (int i = 1; ok && i < k; i++) {
+            queue_contex_t *qctx = malloc(sizeof(queue_contex_t));
+            if (!qctx) {
+                report(1,
+                       "INTERNAL ERROR.  Could not allocate space for split");
+                ok = false;
+                break;
+            }
+            qctx->q = q_new();
+            if (!qctx->q) {
+                free(qctx);
+                report(1, "ERROR: Could not create queue %d of the split", i);
                 ok = false;
                 break;
             }
+            list_add(&qctx->chain, pos);
+            pos = &qctx->chain;
+
+            qctx->size = 0;
+            qctx->id = chain.size++;
+            q_set_mode(qctx->q, q_get_mode(current->q));
+            ctxs[i] = qctx;
+            parts[i - 1] = qctx->q;
+        }
+    } else {
+        ok = false;
+    }
+    exception_cancel();
+
+    if (ok) {
+        set_noallocate_mode(true);
+        if (exception_setup(true))
+            ok = q_split(current->q, parts, k, round_robin);
+        exception_cancel();
+        set_noallocate_mode(false);
+        if (!ok)
+            report(1, "ERROR: Calling split on null queue");
+    }
+
+    /* Each element is expected in its share, keeping the original order */
+    for (int i = 0; ok && i < k; i++) {
+        struct list_head *q = ctxs[i]->q;
+        struct list_head *cur = queue_next(q);
+        int j = round_robin ? i : i * (n / k) + (i < n % k ? i : n % k);
+        int end = round_robin ? n : j + n / k + (i < n % k);
+        int size = 0;
+        for (; ok && j < end; j += round_robin ? k : 1, size++) {
+            ok = cur != q && list_entry(cur, element_t, list) == elems[j];
+            cur = queue_next(cur);
+        }
+        ok = ok && cur == q;
+        ctxs[i]->size = size;
+        if (!ok)
+            report(1, "ERROR: Queue %d does not hold share %d of the split",
+                   ctxs[i]->id, i);
+    }
+    if (!ok)
+        current->size = q_size(current->q);
+
+    free(elems);
+    free(parts);
+    free(ctxs);
+
+    q_show(3);
+    return ok && !error_check();
+}
+
+static bool do_compact(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling compact on null queue");
+        return false;
+    }
+
+    int n = current->size;
+    char **vals = malloc(sizeof(char *) * (n ? n : 1));
+    if (!vals) {
+        report(1, "INTERNAL ERROR.  Could not allocate space for compact");
+        return false;
+    }
+    int cnt = 0;
+    for (struct list_head *cur = current->q->next;
+         cur != current->q && cnt < n; cur = cur->next)
+        vals[cnt++] = strdup(list_entry(cur, element_t, list)->value);
+
+    error_check();
+
+    bool ok = false;
+    if (exception_setup(true))
+        ok = q_compact(current->q);
+    exception_cancel();
+
+    if (!ok) {
+        report(1, "ERROR: Calling compact on null queue or allocation failed");
+    } else {
+        /* Same strings in the same order, at increasing addresses */
+        struct list_head *cur = current->q->next;
+        for (int i = 0; ok && i < cnt; i++, cur = cur->next) {
+            ok = cur != current->q &&
+                 !strcmp(list_entry(cur, element_t, list)->value, vals[i]);
+        }
+        ok = ok && cur == current->q;
+        if (!ok)
+            report(1, "ERROR: Compacted queue does not hold the same strings");
+
+        for (cur = current->q->next; ok && cur->next != current->q;
+             cur = cur->next) {
+            ok = (uintptr_t) cur < (uintptr_t) cur->next;
         }
+        if (!ok)
+            report(1, "ERROR: Elements are not laid out in list order");
+    }
+
+    for (int i = 0; i < cnt; i++)
+        free(vals[i]);
+    free(vals);
+
+    q_show(3);
+    return ok && !error_check();
+}
+
+/* Scratch files of traces: "$$" in a path stands for the process ID, so runs
+ * at the same time do not share files. The files are removed when qtest quits.
+ */
+#define SCRATCH_FILES 16
+#define SCRATCH_PATH_LEN 256
+static char scratch[SCRATCH_FILES][SCRATCH_PATH_LEN];
+static int scratch_count;
+
+/* Copy arg into path with "$$" expanded, false if it does not fit */
+static bool scratch_path(const char *arg, char *path)
+{
+    char *pid = strstr(arg, "$$");
+    int len = pid ? snprintf(path, SCRATCH_PATH_LEN, "%.*s%d%s",
+                             (int) (pid - arg), arg, (int) getpid(), pid + 2)
+                  : snprintf(path, SCRATCH_PATH_LEN, "%s", arg);
+    if (len < 0 || len >= SCRATCH_PATH_LEN) {
+        report(1, "ERROR: Path '%s' is too long", arg);
+        return false;
+    }
+    if (!pid)
+        return true;
+
+    for (int i = 0; i < scratch_count; i++) {
+        if (!strcmp(scratch[i], path))
+            return true;
+    }
+    if (scratch_count < SCRATCH_FILES)
+        strcpy(scratch[scratch_count++], path);
+    return true;
+}
+
+static bool do_save(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling save on null queue");
+        return false;
+    }
+    char path[SCRATCH_PATH_LEN];
+    if (!scratch_path(argv[1], path))
+        return false;
+    error_check();
+
+    bool ok = false;
+    if (exception_setup(true))
+        ok = q_save(current->q, path);
+    exception_cancel();
+
+    if (!ok)
+        report(1, "ERROR: Could not save queue to '%s'", path);
+    else
+        report(2, "Saved %d elements to '%s'", current->size, path);
+    return ok && !error_check();
+}
+
+static bool do_load(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling load on null queue");
+        return false;
+    }
+    char path[SCRATCH_PATH_LEN];
+    if (!scratch_path(argv[1], path))
+        return false;
+    error_check();
+
+    int n = -1;
+    if (exception_setup(true))
+        n = q_load(current->q, path);
+    exception_cancel();
+
+    bool ok = n >= 0;
+    if (!ok) {
+        report(1, "ERROR: Could not load queue from '%s'", path);
+    } else {
+        current->size += n;
+        ok = q_size(current->q) == current->size;
+        if (!ok)
+            report(1, "ERROR: Loaded %d elements but queue size is %d", n,
+                   q_size(current->q));
     }
 
     q_show(3);
     return ok && !error_check();
 }
 
+static bool do_fsort(int argc, char *argv[])
+{
+    if (argc != 3) {
+        report(1, "%s needs 2 arguments", argv[0]);
+        return false;
+    }
+    if (sort_budget <= 0) {
+        report(1, "ERROR: Memory budget 'sortmem' must be positive");
+        return false;
+    }
+    char src[SCRATCH_PATH_LEN], dst[SCRATCH_PATH_LEN];
+    if (!scratch_path(argv[1], src) || !scratch_path(argv[2], dst))
+        return false;
+    error_check();
+
+    bool ok = false;
+    if (exception_setup(true))
+        ok = q_sort_file(src, dst, sort_budget, descend);
+    exception_cancel();
+    if (!ok) {
+        report(1, "ERROR: Could not sort '%s' into '%s'", src, dst);
+        return false;
+    }
+
+    /* Check the output holds the strings of the input, in order */
+    struct list_head *in = NULL, *out = NULL;
+    int n = -1, m = -1;
+    if (exception_setup(true)) {
+        in = q_new();
+        out = q_new();
+        if (in && out) {
+            n = q_load(in, src);
+            m = q_load(out, dst);
+        }
+        if (n > 0)
+            q_sort(in, descend);
+    }
+    exception_cancel();
+
+    ok = n >= 0 && n == m;
+    if (!ok) {
+        report(1, "ERROR: Sorted %d elements into %d", n, m);
+    } else {
+        struct list_head *a = in->next, *b = out->next;
+        for (int i = 0; ok && i < n; i++, a = a->next, b = b->next) {
+            const char *va = list_entry(a, element_t, list)->value;
+            const char *vb = list_entry(b, element_t, list)->value;
+            ok = !strcmp(va, vb);
+            if (!ok)
+                report(1, "ERROR: Element %d is '%s' but should be '%s'", i,
+                       vb, va);
+        }
+    }
+
+    if (exception_setup(true)) {
+        q_free(in);
+        q_free(out);
+    }
+    exception_cancel();
+
+    if (ok)
+        report(2, "Sorted %d elements into '%s'", n, dst);
+    return ok && !error_check();
+}
+
+/* Number of call sites listed by 'memstats' */
+#define MEMSTATS_SITES 10
+
+#if defined(__linux__)
+/* Get the load bias of the executable, listed first */
+static int exe_bias(struct dl_phdr_info *info, size_t size, void *data)
+{
+    *(uintptr_t *) data = info->dlpi_addr;
+    return 1;
+}
+#endif
+
+/* Name the functions of the call sites, as offsets if that fails */
+static void name_sites(const harness_site_t *sites, size_t n,
+                       char names[][128])
+{
+    uintptr_t bias = 0;
+#if defined(__linux__)
+    dl_iterate_phdr(exe_bias, &bias);
+#endif
+    size_t callers = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (sites[i].caller) {
+            snprintf(names[i], 128, "0x%lx",
+                     (unsigned long) ((uintptr_t) sites[i].caller - bias));
+            callers++;
+        } else {
+            snprintf(names[i], 128, "(other sites)");
+        }
+    }
+    if (!callers)
+        return; /* addr2line would read addresses from stdin */
+
+    /* Ask addr2line for the function of the call before each address */
+    char cmd[64 + MEMSTATS_SITES * 20];
+    int len = snprintf(cmd, sizeof(cmd),
+                       "addr2line -f -s -e /proc/%d/exe 2>/dev/null",
+                       (int) getpid());
+    for (size_t i = 0; i < n; i++) {
+        if (sites[i].caller)
+            len += snprintf(cmd + len, sizeof(cmd) - len, " 0x%lx",
+                            (unsigned long) ((uintptr_t) sites[i].caller -
+                                             bias - 1));
+    }
+    fflush(stdout);
+    FILE *f = popen(cmd, "r");
+    if (!f)
+        return;
+
+    char func[48], line[64];
+    for (size_t i = 0; i < n; i++) {
+        if (!sites[i].caller)
+            continue;
+        if (!fgets(func, sizeof(func), f) || !fgets(line, sizeof(line), f))
+            break;
+        func[strcspn(func, "\n")] = '\0';
+        line[strcspn(line, "\n")] = '\0';
+        if (strcmp(func, "??"))
+            snprintf(names[i], 128, "%s (%s)", func, line);
+    }
+    pclose(f);
+}
+
+static bool do_memstats(int argc, char *argv[])
+{
+    if (argc > 2 || (argc == 2 && strcmp(argv[1], "reset"))) {
+        report(1, "%s takes no argument or 'reset'", argv[0]);
+        return false;
+    }
+
+    harness_stats_t stats;
+    harness_stats(&stats);
+    report(1, "Allocations: %zu, frees: %zu, live blocks: %zu", stats.allocs,
+           stats.frees, allocation_check());
+    report(1, "Live bytes: %zu, peak bytes: %zu, plus %zu bytes per block",
+           stats.live_bytes, stats.peak_bytes, stats.overhead);
+
+    report(1, "Size histogram:");
+    for (int k = 0; k < HARNESS_SIZE_CLASSES; k++) {
+        if (stats.size_classes[k])
+            report(1, "  %10zu - %-10zu %zu", k ? (size_t) 1 << k : 0,
+                   ((size_t) 1 << k << 1) - 1, stats.size_classes[k]);
+    }
+
+    harness_site_t sites[MEMSTATS_SITES];
+    char names[MEMSTATS_SITES][128];
+    size_t n = harness_sites(sites, MEMSTATS_SITES);
+    name_sites(sites, n, names);
+    report(1, "Top call sites:");
+    for (size_t i = 0; i < n; i++)
+        report(1, "  %10zu allocations %12zu bytes  %s", sites[i].allocs,
+               sites[i].bytes, names[i]);
+
+    if (argc == 2)
+        harness_stats_reset();
+    return true;
+}
+
 static bool is_circular()
 {
     struct list_head *cur = current->q->next;
@@ -957,7 +2155,8 @@ static bool q_show(int vlevel)
     report_noreturn(vlevel, "l = [");
 
     struct list_head *ori = current->q;
-    struct list_head *cur = current->q->next;
+    bool reversed = q_is_reversed(current->q);
+    struct list_head *cur = reversed ? current->q->prev : current->q->next;
 
     if (exception_setup(true)) {
         while (ok && ori != cur && cnt < current->size) {
@@ -971,7 +2170,7 @@ static bool q_show(int vlevel)
                 }
             }
             cnt++;
-            cur = cur->next;
+            cur = reversed ? cur->prev : cur->next;
             ok = ok && !error_check();
         }
     }
@@ -1093,6 +2292,7 @@ bool q_shuffle(struct list_head *head)
         curr = curr->prev;
         size--;
     }
+    q_invalidate(head);
     return true;
 }
 
@@ -1117,6 +2317,12 @@ static bool do_shuffle(int argc, char *argv[])
     return q_show(0);
 }
 
+/* Restart the fault injection schedules whenever one is set */
+static void fault_changed(int oldval)
+{
+    reset_fault_injection();
+}
+
 static void console_init()
 {
     ADD_COMMAND(new, "Create new queue", "");
@@ -1131,6 +2337,10 @@ static void console_init()
                 "Insert string str at tail of queue n times. Generate random "
                 "string(s) if str equals RAND. (default: n == 1)",
                 "str [n]");
+    ADD_COMMAND(is,
+                "Insert string str in ascending order n times. Generate "
+                "random string(s) if str equals RAND. (default: n == 1)",
+                "str [n]");
     ADD_COMMAND(
         rh,
         "Remove from head of queue. Optionally compare to expected value str",
@@ -1145,7 +2355,53 @@ static void console_init()
     ADD_COMMAND(show, "Show queue contents", "");
     ADD_COMMAND(dm, "Delete middle node in queue", "");
     ADD_COMMAND(dedup, "Delete all nodes that have duplicate string", "");
+    ADD_COMMAND(hdedup,
+                "Delete all nodes whose string appears more than once "
+                "anywhere in queue, which may be unsorted",
+                "");
+    ADD_COMMAND(get, "Show the element at 0-based position i", "i");
+    ADD_COMMAND(ia, "Insert string str at 0-based position i of queue",
+                "str i");
+    ADD_COMMAND(da, "Delete the node at 0-based position i of queue", "i");
+    ADD_COMMAND(find, "Look for the first node holding string str", "str");
+    ADD_COMMAND(rv, "Remove the first node holding string str from queue",
+                "str");
+    ADD_COMMAND(nth,
+                "Find the n-th smallest string, partitioning queue around it",
+                "n");
+    ADD_COMMAND(topk,
+                "Move the k smallest (or largest with descend) strings to the "
+                "front of queue in order",
+                "k");
     ADD_COMMAND(merge, "Merge all the queues into one sorted queue", "");
+    ADD_COMMAND(union,
+                "Merge the next sorted queue into queue, keeping each string "
+                "once",
+                "");
+    ADD_COMMAND(intersect,
+                "Merge the next sorted queue into queue, keeping strings found "
+                "in both once",
+                "");
+    ADD_COMMAND(difference,
+                "Merge the next sorted queue into queue, keeping strings found "
+                "only in queue once",
+                "");
+    ADD_COMMAND(split,
+                "Cut queue into k queues following it in the chain, "
+                "contiguous or round-robin",
+                "k [rr]");
+    ADD_COMMAND(compact,
+                "Relocate nodes and strings of queue into one block in list "
+                "order",
+                "");
+    ADD_COMMAND(save, "Write the strings of queue to file", "file");
+    ADD_COMMAND(load, "Append the strings saved in file to queue", "file");
+    ADD_COMMAND(fsort, "Sort the strings saved in file within 'sortmem' bytes",
+                "in out");
+    ADD_COMMAND(memstats,
+                "Show allocation sizes, peak bytes and call sites, then "
+                "clear them with 'reset'",
+                "[reset]");
     ADD_COMMAND(swap, "Swap every two adjacent nodes in queue", "");
     ADD_COMMAND(ascend,
                 "Remove every node which has a node with a strictly less "
@@ -1161,11 +2417,49 @@ static void console_init()
     add_param("length", &string_length, "Maximum length of displayed string",
               NULL);
     add_param("malloc", &fail_probability, "Malloc failure probability percent",
+              fault_changed);
+    add_param("seed", &fail_seed,
+              "Seed of the random malloc failures, for repeatable runs",
+              fault_changed);
+    add_param("failevery", &fail_every, "Fail every Nth malloc, 0 for none",
+              fault_changed);
+    add_param("failfrom", &fail_first,
+              "Fail mallocs from the Nth one on, 0 for none", fault_changed);
+    add_param("failto", &fail_last,
+              "Stop failing mallocs after the Nth one, 0 for never",
+              fault_changed);
+    add_param("poison", &poison_interval,
+              "Fill and poison one block in every N, 0 for none", NULL);
+    add_param("guard", &guard_size,
+              "Follow mallocs of N bytes or more by a guard page, 0 for none",
+              NULL);
+    add_param("quarantine", &quarantine_size,
+              "Keep N freed blocks poisoned to catch writes after free", NULL);
+    add_param("arena", &arena_mode,
+              "Carve blocks from arena chunks, with huge pages if 2", NULL);
+    add_param("timelimit", &time_limit_ms,
+              "Milliseconds each queue operation may take, 0 for no limit",
               NULL);
     add_param("fail", &fail_limit,
               "Number of times allow queue operations to return false", NULL);
     add_param("descend", &descend,
               "Sort and merge queue in ascending/descending order", NULL);
+    add_param("index", &use_index,
+              "Keep an order-statistics index in queues created afterwards",
+              NULL);
+    add_param("sorted", &use_sorted,
+              "Create queues which keep ascending order on 'is'", NULL);
+    add_param("intern", &use_intern,
+              "Share equal strings among elements of queues created afterwards",
+              NULL);
+    add_param("hash", &use_hash,
+              "Keep a hash index of values in queues created afterwards", NULL);
+    add_param("lazy", &use_lazy,
+              "Reverse queues created afterwards in O(1) with a direction flag",
+              NULL);
+    add_param("sortmem", &sort_budget,
+              "Memory budget in bytes of strings sorted at once by 'fsort'",
+              NULL);
 }
 
 /* Signal handlers */
@@ -1187,6 +2481,27 @@ static void sigalrm_handler(int sig)
         "code is too inefficient");
 }
 
+/* Measure the time a timed command spends in the harness */
+static double harness_timer(bool start)
+{
+    set_harness_timing(start);
+    return harness_time();
+}
+
+/* Report how long the operations under a time limit of a command took */
+static bool guarded_report(int argc, char *argv[])
+{
+    double seconds;
+    if (!guarded_time(&seconds))
+        return true;
+    if (time_limit_ms > 0)
+        report(4, "Time of '%s' = %.3f ms, limit %d ms", argv[0],
+               seconds * 1000, time_limit_ms);
+    else
+        report(4, "Time of '%s' = %.3f ms", argv[0], seconds * 1000);
+    return true;
+}
+
 static void q_init()
 {
     fail_count = 0;
@@ -1198,8 +2513,6 @@ static void q_init()
 static bool q_quit(int argc, char *argv[])
 {
     report(3, "Freeing queue");
-    if (current && current->size > BIG_LIST_SIZE)
-        set_cautious_mode(false);
 
     if (exception_setup(true)) {
         struct list_head *cur = chain.head.next;
@@ -1213,7 +2526,9 @@ static bool q_quit(int argc, char *argv[])
     }
 
     exception_cancel();
-    set_cautious_mode(true);
+
+    for (int i = 0; i < scratch_count; i++)
+        unlink(scratch[i]);
 
     size_t bcnt = allocation_check();
     if (bcnt > 0) {
@@ -1498,6 +2813,8 @@ int main(int argc, char *argv[])
         set_logfile(logfile_name);
 
     add_quit_helper(q_quit);
+    set_time_helper(harness_timer);
+    set_cmd_helper(guarded_report);
 
     bool ok = true;
     ok = ok && run_console(infile_name);
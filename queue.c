@@ -1,8 +1,13 @@
 #include "queue.h"
+#include <fcntl.h>
+#include <limits.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 /* Notice: sometimes, Cppcheck would find the potential NULL pointer bugs,
  * but some of them cannot occur. You can suppress them by adding the
@@ -10,39 +15,836 @@
  *   cppcheck-suppress nullPointer
  */
 
+/* Order-statistics index: an implicit treap whose in-order traversal follows
+ * the list order, so the k-th node of the tree is the k-th element of the
+ * queue. Nodes live in one array and refer to each other by 32-bit index, in
+ * the same way tools/fmtscan.c lays out its node heap. Slot 0 is reserved as
+ * the null node and always has size 0.
+ */
+typedef struct {
+    element_t *e;
+    uint32_t left, right;
+    uint32_t size;
+    uint32_t prio;
+} rank_node_t;
+
+typedef struct {
+    rank_node_t *nodes;
+    uint32_t capacity;
+    uint32_t used; /* slots handed out so far, including slot 0 */
+    uint32_t free; /* recycled slots, chained through @left */
+    uint32_t root;
+    bool valid;
+} rank_index_t;
+
+/* Hash index of values, which only queues with Q_MODE_HASH allocate. Each
+ * element gets a node in a table of its own, found from the address of the
+ * element by linear probing, and the nodes are chained into buckets by the
+ * hash of the value. Within a bucket, elements holding equal strings appear in
+ * list order, so the first match in the bucket is the first one in the queue.
+ * Each bucket also remembers its last node, so adding an element after all
+ * its equals does not walk a chain full of them.
+ * Removed nodes stay in the node table as tombstones, so the nodes chained
+ * never move. Both tables are rebuilt from the list with twice as many
+ * buckets as elements and twice as many node slots as buckets, and dropped
+ * once inserts fill half the node slots.
+ */
+typedef struct {
+    struct hlist_head chain;
+    struct hlist_node *last;
+} hash_bucket_t;
+
+typedef struct {
+    element_t *e; /* NULL if the slot is free, HASH_TOMBSTONE if removed */
+    struct hlist_node link;
+} hash_node_t;
+
+#define HASH_TOMBSTONE ((element_t *) 1)
+
+typedef struct {
+    hash_bucket_t *buckets;
+    hash_node_t *nodes; /* 2 * size slots */
+    uint32_t size;      /* number of buckets, a power of two */
+    uint32_t count;
+    uint32_t used; /* node slots taken, including tombstones */
+    bool valid;
+} hash_index_t;
+
+/**
+ * queue_t - Header behind every queue handed out by q_new()
+ * @head: list head given to callers, must stay the first member
+ * @mode: Q_MODE_* flags selected with q_set_mode()
+ * @rank: order-statistics index, used with Q_MODE_INDEX and Q_MODE_SORTED
+ * @hash: hash index of values, used with Q_MODE_HASH
+ * @ordered: whether the list is known to be ascending, kept for Q_MODE_SORTED
+ * @reversed: whether the logical order runs from the tail of the list to its
+ *            head, set by q_reverse() with Q_MODE_LAZY_REVERSE
+ *
+ * @rank, @hash and @ordered always describe the physical order of the list,
+ * so toggling @reversed leaves them valid.
+ */
+typedef struct {
+    struct list_head head;
+    unsigned int mode;
+    rank_index_t rank;
+    hash_index_t hash;
+    bool ordered;
+    bool reversed;
+} queue_t;
+
+#define queue_of(h) container_of(h, queue_t, head)
+
+/* Blocks handed at once to test_free_batch() by q_free() */
+#define FREE_BATCH 32
+
+/* Number of element arenas made by q_compact() and q_load(), defined with
+ * them below
+ */
+static size_t arena_count;
+
+/* Number of interned strings, defined with the intern table below */
+static size_t intern_count;
+
+static uint32_t rank_seed = 2463534242;
+
+/* xorshift32, good enough to balance the treap */
+static inline uint32_t rank_random()
+{
+    rank_seed ^= rank_seed << 13;
+    rank_seed ^= rank_seed >> 17;
+    rank_seed ^= rank_seed << 5;
+    return rank_seed;
+}
+
+static inline void rank_update(rank_node_t *t, uint32_t n)
+{
+    t[n].size = t[t[n].left].size + t[t[n].right].size + 1;
+}
+
+static uint32_t rank_merge(rank_node_t *t, uint32_t a, uint32_t b)
+{
+    if (!a || !b)
+        return a ? a : b;
+
+    if (t[a].prio > t[b].prio) {
+        t[a].right = rank_merge(t, t[a].right, b);
+        rank_update(t, a);
+        return a;
+    }
+    t[b].left = rank_merge(t, a, t[b].left);
+    rank_update(t, b);
+    return b;
+}
+
+/* Split the tree rooted at n into its first k nodes and the rest */
+static void rank_split(rank_node_t *t,
+                       uint32_t n,
+                       uint32_t k,
+                       uint32_t *l,
+                       uint32_t *r)
+{
+    if (!n) {
+        *l = *r = 0;
+        return;
+    }
+
+    uint32_t lsize = t[t[n].left].size;
+    if (k <= lsize) {
+        rank_split(t, t[n].left, k, l, &t[n].left);
+        *r = n;
+    } else {
+        rank_split(t, t[n].right, k - lsize - 1, &t[n].right, r);
+        *l = n;
+    }
+    rank_update(t, n);
+}
+
+/* Link nodes [lo, hi] into a balanced tree whose priorities stay below prio */
+static uint32_t rank_build(rank_node_t *t,
+                           uint32_t lo,
+                           uint32_t hi,
+                           uint32_t prio)
+{
+    if (lo > hi)
+        return 0;
+
+    uint32_t mid = lo + (hi - lo) / 2;
+    t[mid].prio = prio ? rank_random() % prio : 0;
+    t[mid].left = rank_build(t, lo, mid - 1, t[mid].prio);
+    t[mid].right = rank_build(t, mid + 1, hi, t[mid].prio);
+    rank_update(t, mid);
+    return mid;
+}
+
+static void rank_free(rank_index_t *r)
+{
+    free(r->nodes);
+    r->nodes = NULL;
+    r->capacity = 0;
+    r->valid = false;
+}
+
+/* Reserve room for at least n more nodes, growing the array by doubling */
+static bool rank_reserve(rank_index_t *r, uint32_t n)
+{
+    if (r->used + n <= r->capacity)
+        return true;
+
+    uint32_t capacity = r->capacity ? r->capacity : 64;
+    while (capacity < r->used + n)
+        capacity <<= 1;
+
+    rank_node_t *nodes = malloc(sizeof(rank_node_t) * capacity);
+    if (!nodes)
+        return false;
+    if (r->nodes)
+        memcpy(nodes, r->nodes, sizeof(rank_node_t) * r->used);
+    free(r->nodes);
+    r->nodes = nodes;
+    r->capacity = capacity;
+    return true;
+}
+
+/* Make the index usable, rebuilding it from the list in O(n) if stale */
+static bool rank_ready(queue_t *q)
+{
+    rank_index_t *r = &q->rank;
+    if (!(q->mode & (Q_MODE_INDEX | Q_MODE_SORTED)))
+        return false;
+    if (r->valid)
+        return true;
+
+    uint32_t n = 0;
+    struct list_head *node;
+    list_for_each (node, &q->head)
+        n++;
+
+    r->used = 1;
+    if (!rank_reserve(r, n))
+        return false;
+
+    uint32_t i = 1;
+    list_for_each (node, &q->head)
+        r->nodes[i++].e = list_entry(node, element_t, list);
+    memset(&r->nodes[0], 0, sizeof(rank_node_t));
+    r->root = rank_build(r->nodes, 1, n, UINT32_MAX);
+    r->used = n + 1;
+    r->free = 0;
+    r->valid = true;
+    return true;
+}
+
+static inline uint32_t rank_count(const rank_index_t *r)
+{
+    return r->nodes[r->root].size;
+}
+
+static element_t *rank_at(const rank_index_t *r, uint32_t k)
+{
+    const rank_node_t *t = r->nodes;
+    uint32_t n = r->root;
+    while (n) {
+        uint32_t lsize = t[t[n].left].size;
+        if (k == lsize)
+            return t[n].e;
+        if (k < lsize) {
+            n = t[n].left;
+        } else {
+            k -= lsize + 1;
+            n = t[n].right;
+        }
+    }
+    return NULL;
+}
+
+/* Position of the first element greater than s, i.e. past any equal one.
+ * That element, or NULL if there is none, is stored to *succ.
+ */
+static uint32_t rank_upper_bound(const rank_index_t *r,
+                                 const char *s,
+                                 element_t **succ)
+{
+    const rank_node_t *t = r->nodes;
+    uint32_t n = r->root, k = 0;
+    *succ = NULL;
+    while (n) {
+        if (strcmp(t[n].e->value, s) <= 0) {
+            k += t[t[n].left].size + 1;
+            n = t[n].right;
+        } else {
+            *succ = t[n].e;
+            n = t[n].left;
+        }
+    }
+    return k;
+}
+
+/* Record that e now sits at position k; drops the index if it can't grow */
+static void rank_insert(queue_t *q, uint32_t k, element_t *e)
+{
+    rank_index_t *r = &q->rank;
+    if (!r->valid)
+        return;
+
+    uint32_t slot = r->free;
+    if (slot) {
+        r->free = r->nodes[slot].left;
+    } else if (rank_reserve(r, 1)) {
+        slot = r->used++;
+    } else {
+        r->valid = false;
+        return;
+    }
+
+    rank_node_t *t = r->nodes;
+    t[slot].e = e;
+    t[slot].left = t[slot].right = 0;
+    t[slot].prio = rank_random();
+    t[slot].size = 1;
+
+    uint32_t a, b;
+    rank_split(t, r->root, k, &a, &b);
+    r->root = rank_merge(t, rank_merge(t, a, slot), b);
+}
+
+/* Forget the node at position k and return its element */
+static element_t *rank_remove(queue_t *q, uint32_t k)
+{
+    rank_index_t *r = &q->rank;
+    rank_node_t *t = r->nodes;
+    uint32_t a, b, m;
+
+    rank_split(t, r->root, k, &a, &b);
+    rank_split(t, b, 1, &m, &b);
+    r->root = rank_merge(t, a, b);
+
+    t[m].left = r->free;
+    r->free = m;
+    return t[m].e;
+}
+
+/* 32-bit FNV-1a string hash */
+static inline uint32_t str_hash(const char *s)
+{
+    uint32_t h = 2166136261U;
+    while (*s) {
+        h ^= (unsigned char) *s++;
+        h *= 16777619U;
+    }
+    return h;
+}
+
+static void hash_free(hash_index_t *h)
+{
+    free(h->buckets);
+    free(h->nodes);
+    memset(h, 0, sizeof(*h));
+}
+
+/* Slot of the node of element e, or of the free slot where it would go */
+static hash_node_t *hash_node(const hash_index_t *h, const element_t *e)
+{
+    size_t mask = 2 * (size_t) h->size - 1;
+    size_t i = ((uintptr_t) e * 0x9e3779b97f4a7c15ULL) >> 32 & mask;
+    while (h->nodes[i].e && h->nodes[i].e != e)
+        i = (i + 1) & mask;
+    return &h->nodes[i];
+}
+
+/* Chain node n of element e into its bucket, before or after its equals */
+static void hash_link(hash_index_t *h,
+                      hash_node_t *n,
+                      element_t *e,
+                      bool front)
+{
+    hash_bucket_t *b = &h->buckets[e->hash & (h->size - 1)];
+    n->e = e;
+    if (hlist_empty(&b->chain)) {
+        hlist_add_head(&n->link, &b->chain);
+        b->last = &n->link;
+    } else if (front) {
+        hlist_add_head(&n->link, &b->chain);
+    } else {
+        hlist_add_behind(&n->link, b->last);
+        b->last = &n->link;
+    }
+}
+
+/* Make the hash index usable, rebuilding it from the list in O(n) if stale */
+static bool hash_ready(queue_t *q)
+{
+    hash_index_t *h = &q->hash;
+    if (!(q->mode & Q_MODE_HASH))
+        return false;
+    if (h->valid)
+        return true;
+
+    uint32_t n = 0;
+    struct list_head *node;
+    list_for_each (node, &q->head)
+        n++;
+
+    uint32_t size = 16;
+    while (size < 2 * n)
+        size <<= 1;
+    if (size != h->size) {
+        hash_bucket_t *buckets = malloc(size * sizeof(hash_bucket_t));
+        hash_node_t *nodes = malloc(2 * (size_t) size * sizeof(hash_node_t));
+        if (!buckets || !nodes) {
+            free(buckets);
+            free(nodes);
+            return false;
+        }
+        free(h->buckets);
+        free(h->nodes);
+        h->buckets = buckets;
+        h->nodes = nodes;
+        h->size = size;
+    }
+    for (uint32_t i = 0; i < size; i++) {
+        INIT_HLIST_HEAD(&h->buckets[i].chain);
+        h->buckets[i].last = NULL;
+    }
+    memset(h->nodes, 0, 2 * (size_t) size * sizeof(hash_node_t));
+
+    list_for_each (node, &q->head) {
+        element_t *e = list_entry(node, element_t, list);
+        hash_link(h, hash_node(h, e), e, false);
+    }
+    h->count = h->used = n;
+    h->valid = true;
+    return true;
+}
+
+/* First element holding s in list order, or the last one if last is set */
+static element_t *hash_find(const hash_index_t *h,
+                            const char *s,
+                            uint32_t hash,
+                            bool last)
+{
+    const hash_bucket_t *b = &h->buckets[hash & (h->size - 1)];
+    hash_node_t *n;
+    element_t *found = NULL;
+    if (last && b->last) {
+        element_t *e = hlist_entry(b->last, hash_node_t, link)->e;
+        if (e->hash == hash && !strcmp(e->value, s))
+            return e;
+    }
+    hlist_for_each_entry (n, &b->chain, link) {
+        if (n->e->hash == hash && !strcmp(n->e->value, s)) {
+            found = n->e;
+            if (!last)
+                break;
+        }
+    }
+    return found;
+}
+
+/* Add an element which comes before (front) or after all its equals */
+static void hash_add(queue_t *q, element_t *e, bool front)
+{
+    hash_index_t *h = &q->hash;
+    if (!h->valid)
+        return;
+    if (h->used >= h->size) {
+        h->valid = false;
+        return;
+    }
+
+    hash_link(h, hash_node(h, e), e, front);
+    h->count++;
+    h->used++;
+}
+
+static inline void hash_del(queue_t *q, element_t *e)
+{
+    hash_index_t *h = &q->hash;
+    if (!h->valid)
+        return;
+    hash_node_t *n = hash_node(h, e);
+    if (!n->e) {
+        h->valid = false;
+        return;
+    }
+    hash_bucket_t *b = &h->buckets[e->hash & (h->size - 1)];
+    /* The node before the last one is found through the pointer to it */
+    if (b->last == &n->link)
+        b->last = n->link.pprev == &b->chain.first
+                      ? NULL
+                      : container_of(n->link.pprev, struct hlist_node, next);
+    hlist_del(&n->link);
+    n->e = HASH_TOMBSTONE;
+    h->count--;
+}
+
 /* Create an empty queue */
 struct list_head *q_new()
 {
-    struct list_head *head = malloc(sizeof(struct list_head));
-    if (head == NULL) {
+    queue_t *q = malloc(sizeof(queue_t));
+    if (q == NULL) {
         return NULL;
     }
-    INIT_LIST_HEAD(head);
-    return head;
+    INIT_LIST_HEAD(&q->head);
+    q->mode = 0;
+    memset(&q->rank, 0, sizeof(q->rank));
+    memset(&q->hash, 0, sizeof(q->hash));
+    q->ordered = true;
+    q->reversed = false;
+    return &q->head;
 }
 
 /* Free all storage used by queue */
 void q_free(struct list_head *head)
 {
-    if (!head || list_empty(head)) {
+    if (!head)
+        return;
+
+    rank_free(&queue_of(head)->rank);
+    hash_free(&queue_of(head)->hash);
+    if (list_empty(head)) {
         free(head);
         return;
     }
 
+    /* Interned strings move to other queues and outlive Q_MODE_INTERN, so
+     * any queue may hold some while the intern table is not empty
+     */
     element_t *entry = NULL, *safe = NULL;
+    if (intern_count || arena_count) {
+        /* cppcheck-suppress unusedLabel */
+        list_for_each_entry_safe (entry, safe, head, list)
+            q_release_element(entry);
+        free(head);
+        return;
+    }
+
+    /* Plain elements own both their blocks, freed in batches */
+    void *batch[FREE_BATCH];
+    size_t n = 0;
     /* cppcheck-suppress unusedLabel */
-    list_for_each_entry_safe (entry, safe, head, list)
-        q_release_element(entry);
-    free(head);
+    list_for_each_entry_safe (entry, safe, head, list) {
+        batch[n++] = entry->value;
+        batch[n++] = entry;
+        if (n == FREE_BATCH) {
+            test_free_batch(batch, n);
+            n = 0;
+        }
+    }
+    batch[n++] = head;
+    test_free_batch(batch, n);
 }
 
-static inline element_t *new_element(char *s)
+/* Swap next and prev of every node, head included */
+static void reverse_links(struct list_head *head)
+{
+    struct list_head *curr = head;
+    do {
+        struct list_head *tmp = curr->next;
+        curr->next = curr->prev;
+        curr->prev = tmp;
+        curr = tmp;
+    } while (curr != head);
+}
+
+/* Relink the nodes into logical order if a lazy reversal is pending */
+static void normalize(queue_t *q)
+{
+    if (!q->reversed)
+        return;
+
+    reverse_links(&q->head);
+    q->reversed = false;
+    q->rank.valid = false;
+    q->hash.valid = false;
+    q->ordered = list_empty(&q->head) || list_is_singular(&q->head);
+}
+
+/* Step from node to its logical successor */
+static inline struct list_head *next_of(const queue_t *q,
+                                        const struct list_head *node)
+{
+    return q->reversed ? node->prev : node->next;
+}
+
+/* Select optional features of a queue */
+bool q_set_mode(struct list_head *head, unsigned int mode)
+{
+    if (!head)
+        return false;
+
+    queue_t *q = queue_of(head);
+    if (!(mode & (Q_MODE_INDEX | Q_MODE_SORTED)))
+        rank_free(&q->rank);
+    if (!(mode & Q_MODE_HASH))
+        hash_free(&q->hash);
+    if (!(mode & Q_MODE_LAZY_REVERSE))
+        normalize(q);
+    if (!(q->mode & Q_MODE_SORTED))
+        q->ordered = list_empty(head);
+    q->mode = mode;
+    return true;
+}
+
+/* Report the optional features selected for a queue */
+unsigned int q_get_mode(struct list_head *head)
+{
+    return head ? queue_of(head)->mode : 0;
+}
+
+/* Tell whether the list of a queue is to be walked from its tail */
+bool q_is_reversed(struct list_head *head)
+{
+    return head && queue_of(head)->reversed;
+}
+
+/* Drop cached auxiliary structures of a queue */
+void q_invalidate(struct list_head *head)
+{
+    if (!head)
+        return;
+
+    queue_t *q = queue_of(head);
+    q->rank.valid = false;
+    q->hash.valid = false;
+    q->ordered = false;
+}
+
+/* Clear the ordered flag of a sorted queue if e breaks the ascending order */
+static void order_check(queue_t *q, const element_t *e)
+{
+    if (!(q->mode & Q_MODE_SORTED) || !q->ordered)
+        return;
+
+    const struct list_head *prev = e->list.prev, *next = e->list.next;
+    if ((prev != &q->head &&
+         strcmp(list_entry(prev, element_t, list)->value, e->value) > 0) ||
+        (next != &q->head &&
+         strcmp(e->value, list_entry(next, element_t, list)->value) > 0))
+        q->ordered = false;
+}
+
+/* String interning: equal strings inserted into Q_MODE_INTERN queues share
+ * one reference-counted buffer. The table is global, so strings stay shared
+ * when elements move between queues, and is released along with the last
+ * interned string. It uses open addressing with linear probing, at most half
+ * full, and backward-shift deletion instead of tombstones.
+ */
+typedef struct {
+    uint32_t refcnt;
+    uint32_t hash;
+    char str[];
+} intern_t;
+
+static intern_t **intern_table = NULL;
+static size_t intern_size = 0; /* number of slots, a power of two */
+static size_t intern_count = 0;
+
+static bool intern_grow()
+{
+    size_t size = intern_size ? intern_size << 1 : 64;
+    intern_t **table = calloc(size, sizeof(intern_t *));
+    if (!table)
+        return false;
+
+    for (size_t i = 0; i < intern_size; i++) {
+        if (!intern_table[i])
+            continue;
+        size_t j = intern_table[i]->hash & (size - 1);
+        while (table[j])
+            j = (j + 1) & (size - 1);
+        table[j] = intern_table[i];
+    }
+    free(intern_table);
+    intern_table = table;
+    intern_size = size;
+    return true;
+}
+
+/* Take a reference to the interned copy of s, creating it if needed */
+static char *intern_get(const char *s, uint32_t hash)
+{
+    if (2 * (intern_count + 1) > intern_size && !intern_grow())
+        return NULL;
+
+    size_t mask = intern_size - 1, i = hash & mask;
+    for (; intern_table[i]; i = (i + 1) & mask) {
+        intern_t *in = intern_table[i];
+        if (in->hash == hash && !strcmp(in->str, s)) {
+            in->refcnt++;
+            return in->str;
+        }
+    }
+
+    size_t len = strlen(s) + 1;
+    intern_t *in = malloc(sizeof(intern_t) + len);
+    if (!in)
+        return NULL;
+    in->refcnt = 1;
+    in->hash = hash;
+    memcpy(in->str, s, len);
+    intern_table[i] = in;
+    intern_count++;
+    return in->str;
+}
+
+/* Slot of the interned copy value points to, or an empty slot */
+static size_t intern_slot(const char *value, uint32_t hash)
+{
+    size_t mask = intern_size - 1, i = hash & mask;
+    while (intern_table[i] && intern_table[i]->str != value)
+        i = (i + 1) & mask;
+    return i;
+}
+
+/* Tell whether value is the interned copy of a string */
+static inline bool intern_has(const char *value, uint32_t hash)
+{
+    return intern_count && intern_table[intern_slot(value, hash)];
+}
+
+/* Drop a reference to value if it is interned, return false if it is not */
+static bool intern_put(const char *value, uint32_t hash)
+{
+    if (!intern_count)
+        return false;
+
+    size_t mask = intern_size - 1, i = intern_slot(value, hash);
+    intern_t *in = intern_table[i];
+    if (!in)
+        return false;
+    if (--in->refcnt)
+        return true;
+
+    /* Pull back later entries of the probe chain that may fill the hole */
+    for (size_t j = (i + 1) & mask; intern_table[j]; j = (j + 1) & mask) {
+        size_t home = intern_table[j]->hash & mask;
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            intern_table[i] = intern_table[j];
+            i = j;
+        }
+    }
+    intern_table[i] = NULL;
+    free(in);
+
+    if (!--intern_count) {
+        free(intern_table);
+        intern_table = NULL;
+        intern_size = 0;
+    }
+    return true;
+}
+
+/* Arenas made by q_compact() and q_load(): the elements of a queue and their
+ * strings in one block. q_compact() lays them out in list order, each string
+ * right after its element, and q_load() puts the strings after all the
+ * elements. An arena is freed along with the last of its elements. Live
+ * arenas are kept sorted by address, so the arena holding an element is found
+ * by binary search, and no search happens at all while there is none.
+ */
+typedef struct {
+    size_t live; /* elements not released yet */
+    size_t size; /* bytes of @data */
+    char data[];
+} arena_t;
+
+static arena_t **arena_list = NULL;
+static size_t arena_count = 0, arena_capacity = 0;
+
+/* Round n up to a multiple of the alignment of element_t */
+#define ARENA_ALIGN(n) \
+    (((n) + _Alignof(element_t) - 1) & ~(_Alignof(element_t) - 1))
+
+/* Arena holding the object at p, NULL if p was allocated on its own */
+static arena_t *arena_of(const void *p)
+{
+    if (!arena_count)
+        return NULL;
+
+    size_t lo = 0, hi = arena_count;
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if ((uintptr_t) arena_list[mid] <= (uintptr_t) p)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    arena_t *a = arena_list[lo];
+    if ((uintptr_t) p < (uintptr_t) a->data ||
+        (uintptr_t) p >= (uintptr_t) (a->data + a->size))
+        return NULL;
+    return a;
+}
+
+static bool arena_add(arena_t *a)
+{
+    if (arena_count == arena_capacity) {
+        size_t capacity = arena_capacity ? arena_capacity << 1 : 8;
+        arena_t **list = malloc(capacity * sizeof(arena_t *));
+        if (!list)
+            return false;
+        if (arena_count)
+            memcpy(list, arena_list, arena_count * sizeof(arena_t *));
+        free(arena_list);
+        arena_list = list;
+        arena_capacity = capacity;
+    }
+
+    size_t i = arena_count++;
+    for (; i && (uintptr_t) arena_list[i - 1] > (uintptr_t) a; i--)
+        arena_list[i] = arena_list[i - 1];
+    arena_list[i] = a;
+    return true;
+}
+
+/* Drop an element of arena a, freeing the arena with its last element */
+static void arena_put(arena_t *a)
+{
+    if (--a->live)
+        return;
+
+    size_t i = 0;
+    while (arena_list[i] != a)
+        i++;
+    memmove(&arena_list[i], &arena_list[i + 1],
+            (--arena_count - i) * sizeof(arena_t *));
+    free(a);
+
+    if (!arena_count) {
+        free(arena_list);
+        arena_list = NULL;
+        arena_capacity = 0;
+    }
+}
+
+void q_release_element(element_t *e)
+{
+    arena_t *a = arena_of(e);
+    if (!intern_put(e->value, e->hash) && !a)
+        free(e->value);
+    if (a)
+        arena_put(a);
+    else
+        free(e);
+}
+
+/* Equal strings are the same pointer when interned, else compare hashes */
+static inline bool element_equal(const element_t *a, const element_t *b)
+{
+    return a->value == b->value ||
+           (a->hash == b->hash && !strcmp(a->value, b->value));
+}
+
+static inline element_t *new_element(const queue_t *q, char *s)
 {
     element_t *e = malloc(sizeof(element_t));
     if (!e)
         return NULL;
 
-    e->value = strdup(s);
+    e->hash = str_hash(s);
+    if (q->mode & Q_MODE_INTERN)
+        e->value = intern_get(s, e->hash);
+    else
+        e->value = strdup(s);
     if (!e->value) {
         free(e);
         return NULL;
@@ -50,77 +852,261 @@ static inline element_t *new_element(char *s)
     return e;
 }
 
-/* Insert an element at head of queue */
-bool q_insert_head(struct list_head *head, char *s)
+/* Insert an element at the physical head or tail of the list */
+static bool insert_end(struct list_head *head, char *s, bool tail)
 {
     if (!head) {
         return false;
     }
-    element_t *element = new_element(s);
+    queue_t *q = queue_of(head);
+    element_t *element = new_element(q, s);
     if (!element) {
         return false;
     }
 
-    list_add(&element->list, head);
+    if (tail) {
+        list_add_tail(&element->list, head);
+        if (q->rank.valid)
+            rank_insert(q, rank_count(&q->rank), element);
+    } else {
+        list_add(&element->list, head);
+        rank_insert(q, 0, element);
+    }
+    hash_add(q, element, !tail);
+    order_check(q, element);
     return true;
 }
 
+/* Insert an element at head of queue */
+bool q_insert_head(struct list_head *head, char *s)
+{
+    return insert_end(head, s, head && queue_of(head)->reversed);
+}
+
 /* Insert an element at tail of queue */
 bool q_insert_tail(struct list_head *head, char *s)
 {
-    if (!head) {
+    return insert_end(head, s, !head || !queue_of(head)->reversed);
+}
+
+/* Insert an element while keeping ascending order */
+bool q_insert_sorted(struct list_head *head, char *s)
+{
+    if (!head)
         return false;
+
+    queue_t *q = queue_of(head);
+    normalize(q);
+    if (!(q->mode & Q_MODE_SORTED)) {
+        /* Nothing tracks the order of a plain queue, so check it here */
+        q->ordered = true;
+        for (struct list_head *n = head->next; n->next != head; n = n->next) {
+            if (strcmp(list_entry(n, element_t, list)->value,
+                       list_entry(n->next, element_t, list)->value) > 0) {
+                q->ordered = false;
+                break;
+            }
+        }
     }
-    element_t *element = new_element(s);
-    if (!element) {
-        return false;
+    if (!q->ordered)
+        q_sort(head, false);
+
+    struct list_head *pos = head;
+    uint32_t k = 0;
+    if (rank_ready(q)) {
+        element_t *succ;
+        k = rank_upper_bound(&q->rank, s, &succ);
+        if (succ)
+            pos = &succ->list;
+    } else {
+        for (pos = head->next; pos != head; pos = pos->next) {
+            if (strcmp(list_entry(pos, element_t, list)->value, s) > 0)
+                break;
+        }
     }
-    list_add_tail(&element->list, head);
+
+    element_t *element = new_element(q, s);
+    if (!element)
+        return false;
+
+    list_add_tail(&element->list, pos);
+    rank_insert(q, k, element);
+    hash_add(q, element, false);
     return true;
 }
 
-/* Remove an element from head of queue */
-element_t *q_remove_head(struct list_head *head, char *sp, size_t bufsize)
+/* Remove an element from the physical head or tail of the list */
+static element_t *remove_end(struct list_head *head,
+                             char *sp,
+                             size_t bufsize,
+                             bool tail)
 {
     if (list_empty(head)) {
         return NULL;
     }
-    element_t *entry = list_first_entry(head, element_t, list);
+    element_t *entry = tail ? list_last_entry(head, element_t, list)
+                            : list_first_entry(head, element_t, list);
     if (sp && entry->value) {
         strncpy(sp, entry->value, bufsize - 1);
         sp[bufsize - 1] = '\0';
     }
     list_del_init(&entry->list);
+    rank_index_t *r = &queue_of(head)->rank;
+    if (r->valid)
+        rank_remove(queue_of(head), tail ? rank_count(r) - 1 : 0);
+    hash_del(queue_of(head), entry);
     return entry;
 }
 
+/* Remove an element from head of queue */
+element_t *q_remove_head(struct list_head *head, char *sp, size_t bufsize)
+{
+    return remove_end(head, sp, bufsize, queue_of(head)->reversed);
+}
+
 /* Remove an element from tail of queue */
 element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize)
 {
-    if (list_empty(head)) {
+    return remove_end(head, sp, bufsize, !queue_of(head)->reversed);
+}
+
+/* Return number of elements in queue */
+int q_size(struct list_head *head)
+{
+    if (!head)
+        return 0;
+
+    int len = 0;
+
+    struct list_head *current;
+    list_for_each (current, head)
+        len++;
+    return len;
+}
+
+/* Get the element at a given position */
+element_t *q_get(struct list_head *head, int index)
+{
+    if (!head || index < 0)
         return NULL;
+
+    queue_t *q = queue_of(head);
+    if (rank_ready(q)) {
+        uint32_t n = rank_count(&q->rank);
+        if ((uint32_t) index >= n)
+            return NULL;
+        return rank_at(&q->rank, q->reversed ? n - 1 - index : index);
     }
-    element_t *entry = list_last_entry(head, element_t, list);
-    if (sp && entry->value) {
-        strncpy(sp, entry->value, bufsize - 1);
-        sp[bufsize - 1] = '\0';
+
+    for (struct list_head *node = next_of(q, head); node != head;
+         node = next_of(q, node)) {
+        if (!index--)
+            return list_entry(node, element_t, list);
+    }
+    return NULL;
+}
+
+/* Insert an element at a given position */
+bool q_insert_at(struct list_head *head, int index, char *s)
+{
+    if (!head || index < 0)
+        return false;
+
+    queue_t *q = queue_of(head);
+    struct list_head *pos = head;
+    uint32_t k = index; /* physical position of the new element */
+    if (rank_ready(q)) {
+        uint32_t n = rank_count(&q->rank);
+        if ((uint32_t) index > n)
+            return false;
+        if (q->reversed)
+            k = n - index;
+        if (k < n)
+            pos = &rank_at(&q->rank, k)->list;
+    } else {
+        int i = 0;
+        for (pos = next_of(q, head); pos != head && i < index;
+             pos = next_of(q, pos))
+            i++;
+        if (i < index)
+            return false;
+        /* Logically in front of the node at @index is physically behind it */
+        if (q->reversed)
+            pos = pos->next;
+    }
+
+    element_t *element = new_element(q, s);
+    if (!element)
+        return false;
+
+    /* Adding in front of the node at @k makes the new one take its place */
+    list_add_tail(&element->list, pos);
+    rank_insert(q, k, element);
+    /* Where it goes among its equals is unknown without walking the list */
+    if (q->hash.valid && hash_find(&q->hash, s, element->hash, false))
+        q->hash.valid = false;
+    hash_add(q, element, true);
+    order_check(q, element);
+    return true;
+}
+
+/* Delete the element at a given position */
+bool q_delete_at(struct list_head *head, int index)
+{
+    if (!head || index < 0)
+        return false;
+
+    queue_t *q = queue_of(head);
+    element_t *e;
+    if (rank_ready(q)) {
+        uint32_t n = rank_count(&q->rank);
+        if ((uint32_t) index >= n)
+            return false;
+        e = rank_remove(q, q->reversed ? n - 1 - index : index);
+    } else {
+        e = q_get(head, index);
+        if (!e)
+            return false;
+    }
+
+    list_del(&e->list);
+    hash_del(q, e);
+    q_release_element(e);
+    return true;
+}
+
+/* Find the first element holding a given string */
+element_t *q_find(struct list_head *head, char *s)
+{
+    if (!head || !s)
+        return NULL;
+
+    queue_t *q = queue_of(head);
+    if (hash_ready(q))
+        return hash_find(&q->hash, s, str_hash(s), q->reversed);
+
+    for (struct list_head *node = next_of(q, head); node != head;
+         node = next_of(q, node)) {
+        element_t *e = list_entry(node, element_t, list);
+        if (!strcmp(e->value, s))
+            return e;
     }
-    list_del_init(&entry->list);
-    return entry;
+    return NULL;
 }
 
-/* Return number of elements in queue */
-int q_size(struct list_head *head)
+/* Remove the first element holding a given string */
+element_t *q_remove_value(struct list_head *head, char *s)
 {
-    if (!head)
-        return 0;
-
-    int len = 0;
+    element_t *e = q_find(head, s);
+    if (!e)
+        return NULL;
 
-    struct list_head *current;
-    list_for_each (current, head)
-        len++;
-    return len;
+    queue_t *q = queue_of(head);
+    list_del_init(&e->list);
+    hash_del(q, e);
+    /* Removing leaves a sorted queue sorted, but its position is unknown */
+    q->rank.valid = false;
+    return e;
 }
 
 /* Delete the middle node in queue */
@@ -130,13 +1116,18 @@ bool q_delete_mid(struct list_head *head)
         return false;
     }
 
-    struct list_head *slow = head->next;
-    struct list_head *fast = head->next;
-    while (fast != head && fast->next != head) {
-        slow = slow->next;
-        fast = fast->next->next;
+    queue_t *q = queue_of(head);
+    if (rank_ready(q))
+        return q_delete_at(head, rank_count(&q->rank) / 2);
+
+    struct list_head *slow = next_of(q, head);
+    struct list_head *fast = slow;
+    while (fast != head && next_of(q, fast) != head) {
+        slow = next_of(q, slow);
+        fast = next_of(q, next_of(q, fast));
     }
     list_del_init(slow);
+    hash_del(q, list_entry(slow, element_t, list));
     q_release_element(list_entry(slow, element_t, list));
 
     return true;
@@ -148,19 +1139,21 @@ bool q_delete_dup(struct list_head *head)
     if (!head || list_empty(head)) {
         return false;
     }
+    queue_t *q = queue_of(head);
+    q->rank.valid = false;
     struct list_head **indirect = &head->next;
 
     while (*indirect != head) {
-        const char *cur_val = list_entry(*indirect, element_t, list)->value;
+        const element_t *cur = list_entry(*indirect, element_t, list);
         bool dup = false;
 
         while ((*indirect)->next != head &&
-               strcmp(cur_val,
-                      list_entry((*indirect)->next, element_t, list)->value) ==
-                   0) {
+               element_equal(cur,
+                             list_entry((*indirect)->next, element_t, list))) {
             dup = true;
             struct list_head *dup_node = (*indirect)->next;
             list_del(dup_node);
+            hash_del(q, list_entry(dup_node, element_t, list));
             q_release_element(list_entry(dup_node, element_t, list));
         }
 
@@ -168,6 +1161,7 @@ bool q_delete_dup(struct list_head *head)
             struct list_head *temp = *indirect;
             list_del_init(*indirect);  // indirect would be automatically
                                        // updated
+            hash_del(q, list_entry(temp, element_t, list));
             q_release_element(list_entry(temp, element_t, list));
         } else {
             indirect = &(*indirect)->next;
@@ -176,6 +1170,63 @@ bool q_delete_dup(struct list_head *head)
     return true;
 }
 
+/* Hash set slot holding an element, with this bit set once a copy is seen */
+#define DUP_SEEN ((uintptr_t) 1)
+
+/* Delete all nodes whose string appears more than once anywhere in queue */
+bool q_delete_dup_unsorted(struct list_head *head)
+{
+    if (!head || list_empty(head))
+        return false;
+
+    size_t n = 0;
+    struct list_head *node, *safe;
+    list_for_each (node, head)
+        n++;
+
+    /* Open addressing with linear probing, kept at most half full */
+    size_t size = 2;
+    while (size < 2 * n)
+        size <<= 1;
+    uintptr_t *set = calloc(size, sizeof(uintptr_t));
+    if (!set)
+        return false;
+
+    size_t mask = size - 1;
+    queue_t *q = queue_of(head);
+    q->rank.valid = false;
+    list_for_each_safe (node, safe, head) {
+        element_t *e = list_entry(node, element_t, list);
+        size_t i = e->hash & mask;
+        for (; set[i]; i = (i + 1) & mask) {
+            const element_t *first = (element_t *) (set[i] & ~DUP_SEEN);
+            if (element_equal(first, e))
+                break;
+        }
+
+        if (!set[i]) {
+            set[i] = (uintptr_t) e;
+            continue;
+        }
+        /* Later copies go right away, the first one after the scan */
+        set[i] |= DUP_SEEN;
+        list_del(node);
+        hash_del(q, e);
+        q_release_element(e);
+    }
+
+    for (size_t i = 0; i < size; i++) {
+        if (set[i] & DUP_SEEN) {
+            element_t *e = (element_t *) (set[i] & ~DUP_SEEN);
+            list_del(&e->list);
+            hash_del(q, e);
+            q_release_element(e);
+        }
+    }
+    free(set);
+    return true;
+}
+
 /* Swap every two adjacent nodes */
 void q_swap(struct list_head *head)
 {
@@ -190,13 +1241,13 @@ void q_reverse(struct list_head *head)
     if (!head || list_empty(head))
         return;
 
-    struct list_head *curr = head;
-    do {
-        struct list_head *tmp = curr->next;
-        curr->next = curr->prev;
-        curr->prev = tmp;
-        curr = tmp;
-    } while (curr != head);
+    queue_t *q = queue_of(head);
+    if (q->mode & Q_MODE_LAZY_REVERSE) {
+        q->reversed = !q->reversed;
+        return;
+    }
+    q_invalidate(head);
+    reverse_links(head);
 }
 
 void reverse_segment(struct list_head *head, struct list_head *tail)
@@ -225,6 +1276,8 @@ void q_reverseK(struct list_head *head, int k)
 {
     if (!head || list_empty(head))
         return;
+    normalize(queue_of(head));
+    q_invalidate(head);
 
     struct list_head *curr = head->next;
     while (curr != head) {
@@ -246,8 +1299,10 @@ static inline bool compare(struct list_head *left,
                            struct list_head *right,
                            bool descend)
 {
-    int result = strcmp(list_entry(left, element_t, list)->value,
-                        list_entry(right, element_t, list)->value);
+    const char *l = list_entry(left, element_t, list)->value;
+    const char *r = list_entry(right, element_t, list)->value;
+    /* Interned strings that are equal share storage */
+    int result = l == r ? 0 : strcmp(l, r);
     return descend ? result >= 0 : result <= 0;
 }
 
@@ -334,8 +1389,18 @@ struct list_head *merge_sort_recursive(struct list_head *head, bool descend)
 /* Sort elements of queue in ascending/descending order */
 void q_sort(struct list_head *head, bool descend)
 {
-    if (list_empty(head) || list_is_singular(head))
+    queue_t *q = queue_of(head);
+    /* Equal strings have to keep their logical order */
+    normalize(q);
+    if (list_empty(head) || list_is_singular(head)) {
+        q->ordered = true;
         return;
+    }
+
+    if ((q->mode & Q_MODE_SORTED) && q->ordered && !descend)
+        return;
+    /* Merge sort is stable, so equal strings keep their order in the hash */
+    q->rank.valid = false;
     // temporary remove the head
     struct list_head *first = head->next;
     struct list_head *last = head->prev;
@@ -349,12 +1414,288 @@ void q_sort(struct list_head *head, bool descend)
     head->prev = sorted->prev;
     head->next = sorted;
     sorted->prev = head;
+    q->ordered = !descend;
+}
+
+/* Candidate kept by q_topk(), @pos breaks ties between equal strings */
+typedef struct {
+    element_t *e;
+    size_t pos;
+} topk_entry_t;
+
+/* Whether a would come after b in the sorted queue */
+static inline bool topk_after(const topk_entry_t *a,
+                              const topk_entry_t *b,
+                              bool descend)
+{
+    int cmp = a->e->value == b->e->value ? 0
+                                         : strcmp(a->e->value, b->e->value);
+    if (descend)
+        cmp = -cmp;
+    return cmp > 0 || (cmp == 0 && a->pos > b->pos);
+}
+
+/* Sift slot i down, keeping the candidate which sorts last on top */
+static void topk_sift_down(topk_entry_t *heap,
+                           size_t n,
+                           size_t i,
+                           bool descend)
+{
+    topk_entry_t x = heap[i];
+    for (size_t c; (c = 2 * i + 1) < n; i = c) {
+        if (c + 1 < n && topk_after(&heap[c + 1], &heap[c], descend))
+            c++;
+        if (!topk_after(&heap[c], &x, descend))
+            break;
+        heap[i] = heap[c];
+    }
+    heap[i] = x;
+}
+
+/* Move the k smallest or largest elements to the front of queue */
+bool q_topk(struct list_head *head, int k, bool descend)
+{
+    if (!head || k < 0)
+        return false;
+
+    queue_t *q = queue_of(head);
+    if (!k || list_empty(head))
+        return true;
+    if ((q->mode & Q_MODE_SORTED) && q->ordered && !descend && !q->reversed)
+        return true;
+
+    size_t n = 0;
+    struct list_head *node;
+    list_for_each (node, head)
+        n++;
+    if ((size_t) k > n)
+        k = n;
+
+    topk_entry_t *heap = malloc(sizeof(topk_entry_t) * k);
+    if (!heap)
+        return false;
+
+    normalize(q);
+    size_t size = 0, pos = 0;
+    list_for_each (node, head) {
+        topk_entry_t x = {list_entry(node, element_t, list), pos++};
+        if (size < (size_t) k) {
+            size_t i = size++;
+            for (; i && topk_after(&x, &heap[(i - 1) / 2], descend);
+                 i = (i - 1) / 2)
+                heap[i] = heap[(i - 1) / 2];
+            heap[i] = x;
+        } else if (topk_after(&heap[0], &x, descend)) {
+            heap[0] = x;
+            topk_sift_down(heap, size, 0, descend);
+        }
+    }
+
+    /* Popping the candidate which sorts last first and moving each one to
+     * the front leaves the winners in order, ahead of the untouched rest.
+     */
+    while (size) {
+        list_move(&heap[0].e->list, head);
+        heap[0] = heap[--size];
+        topk_sift_down(heap, size, 0, descend);
+    }
+    free(heap);
+
+    /* Equal strings keep their relative order, so only positions change */
+    q->rank.valid = false;
+    q->ordered = q->ordered && !descend;
+    return true;
+}
+
+static inline int value_cmp(const element_t *a, const element_t *b)
+{
+    return a->value == b->value ? 0 : strcmp(a->value, b->value);
+}
+
+/* Reservoir of three elements picked at random from those offered */
+typedef struct {
+    element_t *e[3];
+    size_t n;
+} sample_t;
+
+static inline void sample_add(sample_t *s, element_t *e)
+{
+    size_t i = s->n < 3 ? s->n : rank_random() % (s->n + 1);
+    if (i < 3)
+        s->e[i] = e;
+    s->n++;
+}
+
+static element_t *sample_median(const sample_t *s)
+{
+    if (s->n < 3)
+        return s->e[0];
+
+    element_t *a = s->e[0], *b = s->e[1], *c = s->e[2];
+    if (value_cmp(a, b) > 0) {
+        element_t *t = a;
+        a = b;
+        b = t;
+    }
+    if (value_cmp(b, c) > 0)
+        b = value_cmp(a, c) > 0 ? a : c;
+    return b;
+}
+
+static element_t *select_kth(struct list_head *list,
+                             size_t m,
+                             size_t k,
+                             const sample_t *sample);
+
+/* Median of medians of groups of five, a pivot which leaves at least 3/10 of
+ * the elements on each side. Groups are sorted in place, so the order of the
+ * list changes.
+ */
+static element_t *select_pivot_mom(struct list_head *list)
+{
+    LIST_HEAD(rest);
+    LIST_HEAD(medians);
+    sample_t sample = {.n = 0};
+
+    while (!list_empty(list)) {
+        LIST_HEAD(group);
+        size_t g = 0;
+        /* Insertion sort the next five nodes into group */
+        for (; g < 5 && !list_empty(list); g++) {
+            struct list_head *node = list->next, *pos = group.prev;
+            const element_t *e = list_entry(node, element_t, list);
+            while (pos != &group &&
+                   value_cmp(list_entry(pos, element_t, list), e) > 0)
+                pos = pos->prev;
+            list_move(node, pos);
+        }
+        struct list_head *mid = group.next;
+        for (size_t i = 0; i < g / 2; i++)
+            mid = mid->next;
+        sample_add(&sample, list_entry(mid, element_t, list));
+        list_move_tail(mid, &medians);
+        list_splice_tail(&group, &rest);
+    }
+
+    element_t *pivot = select_kth(&medians, sample.n, sample.n / 2, &sample);
+    list_splice_tail(&rest, list);
+    list_splice_tail(&medians, list);
+    return pivot;
+}
+
+/* Rearrange the m nodes of list so that the k-th smallest one sits at
+ * position k, with no greater node before it and no smaller one after it.
+ * The pivot of each three-way partition is the median of three nodes sampled
+ * while the previous pass went over them, for expected O(m) time. Once the
+ * passes have visited 4m nodes, the remaining ones use the median of medians
+ * instead, which bounds the worst case to O(m) too.
+ */
+static element_t *select_kth(struct list_head *list,
+                             size_t m,
+                             size_t k,
+                             const sample_t *sample)
+{
+    LIST_HEAD(lo); /* settled nodes before the remaining range */
+    LIST_HEAD(hi); /* settled nodes after the remaining range */
+    element_t *found = NULL;
+    size_t budget = 4 * m;
+    sample_t cand = *sample;
+
+    while (!found) {
+        element_t *pivot;
+        if (budget >= m) {
+            budget -= m;
+            pivot = sample_median(&cand);
+        } else {
+            pivot = select_pivot_mom(list);
+        }
+
+        LIST_HEAD(less);
+        LIST_HEAD(equal);
+        LIST_HEAD(greater);
+        sample_t sless = {.n = 0}, sgreater = {.n = 0};
+        size_t nequal = 0;
+        struct list_head *node, *safe;
+        list_for_each_safe (node, safe, list) {
+            element_t *e = list_entry(node, element_t, list);
+            int cmp = value_cmp(e, pivot);
+            if (cmp < 0) {
+                list_move_tail(node, &less);
+                sample_add(&sless, e);
+            } else if (cmp == 0) {
+                list_move_tail(node, &equal);
+                nequal++;
+            } else {
+                list_move_tail(node, &greater);
+                sample_add(&sgreater, e);
+            }
+        }
+
+        size_t nless = sless.n;
+        if (k < nless) {
+            list_splice(&greater, &hi);
+            list_splice(&equal, &hi);
+            list_splice_tail(&less, list);
+            m = nless;
+            cand = sless;
+        } else if (k < nless + nequal) {
+            node = equal.next;
+            for (k -= nless; k; k--)
+                node = node->next;
+            found = list_entry(node, element_t, list);
+            list_splice_tail(&less, &lo);
+            list_splice_tail(&equal, &lo);
+            list_splice(&greater, &hi);
+        } else {
+            list_splice_tail(&less, &lo);
+            list_splice_tail(&equal, &lo);
+            list_splice_tail(&greater, list);
+            k -= nless + nequal;
+            m = sgreater.n;
+            cand = sgreater;
+        }
+    }
+
+    list_splice_tail(&lo, list);
+    list_splice_tail(&hi, list);
+    return found;
+}
+
+/* Find the n-th smallest element, partitioning the queue around it */
+element_t *q_nth(struct list_head *head, int n)
+{
+    if (!head || n < 0)
+        return NULL;
+
+    queue_t *q = queue_of(head);
+    normalize(q);
+    bool ordered = (q->mode & Q_MODE_SORTED) && q->ordered;
+    if (ordered && q->rank.valid)
+        return (uint32_t) n < rank_count(&q->rank) ? rank_at(&q->rank, n)
+                                                   : NULL;
+
+    sample_t sample = {.n = 0};
+    struct list_head *node;
+    list_for_each (node, head) {
+        /* An ordered queue already has the answer in place */
+        if (ordered && sample.n == (size_t) n)
+            return list_entry(node, element_t, list);
+        sample_add(&sample, list_entry(node, element_t, list));
+    }
+    if ((size_t) n >= sample.n)
+        return NULL;
+
+    q_invalidate(head);
+    return select_kth(head, sample.n, n, &sample);
 }
 
 int q_filter(struct list_head *head, bool is_ascend)
 {
     if (!head || list_empty(head))
         return 0;
+    queue_t *q = queue_of(head);
+    normalize(q);
+    q->rank.valid = false;
 
     struct list_head *curr = head->next;
     struct list_head **stack =
@@ -370,6 +1711,7 @@ int q_filter(struct list_head *head, bool is_ascend)
                  strcmp(list_entry(stack[top], element_t, list)->value,
                         list_entry(curr, element_t, list)->value) < 0))) {
             list_del_init(stack[top]);
+            hash_del(q, list_entry(stack[top], element_t, list));
             q_release_element(list_entry(stack[top], element_t, list));
             top--;
         }
@@ -435,6 +1777,653 @@ void merge_lists_with_sentinel_node(struct list_head *l1,
 }
 
 
+/* Which strings a set operation keeps, by the queues they are found in */
+typedef enum {
+    SET_UNION,
+    SET_INTERSECT,
+    SET_DIFFERENCE,
+} set_op_t;
+
+/* Release the leading nodes of list holding the same string as e */
+static void skip_equal(struct list_head *list, const element_t *e)
+{
+    while (!list_empty(list)) {
+        element_t *first = list_first_entry(list, element_t, list);
+        if (!element_equal(first, e))
+            break;
+        list_del(&first->list);
+        q_release_element(first);
+    }
+}
+
+/* Merge two sorted lists like merge_lists_with_sentinel_node(), keeping one
+ * node of each distinct string selected by op and releasing the rest. It does
+ * not reuse that merge, since a merged list no longer tells which list each
+ * node came from, and intersection and difference depend on it.
+ */
+static int merge_lists_set(struct list_head *l1,
+                           struct list_head *l2,
+                           bool descend,
+                           set_op_t op)
+{
+    LIST_HEAD(result);
+    int n = 0;
+
+    while (!list_empty(l1) || !list_empty(l2)) {
+        element_t *a = list_empty(l1) ? NULL
+                                      : list_first_entry(l1, element_t, list);
+        element_t *b = list_empty(l2) ? NULL
+                                      : list_first_entry(l2, element_t, list);
+        int cmp = !a        ? 1
+                  : !b      ? -1
+                  : descend ? value_cmp(b, a)
+                            : value_cmp(a, b);
+
+        /* Take the node coming first, and its equal in the other list */
+        element_t *e = cmp <= 0 ? a : b;
+        bool in1 = cmp <= 0, in2 = cmp >= 0;
+        bool keep = op == SET_UNION ? true
+                    : op == SET_INTERSECT ? in1 && in2
+                                          : in1 && !in2;
+        list_move_tail(&e->list, &result);
+        skip_equal(l1, e);
+        skip_equal(l2, e);
+        if (keep) {
+            n++;
+        } else {
+            list_del(&e->list);
+            q_release_element(e);
+        }
+
+        /* Nothing left can be kept once the deciding list runs out */
+        if ((op == SET_INTERSECT && (list_empty(l1) || list_empty(l2))) ||
+            (op == SET_DIFFERENCE && list_empty(l1))) {
+            struct list_head *node, *safe;
+            list_for_each_safe (node, safe, l2)
+                q_release_element(list_entry(node, element_t, list));
+            list_for_each_safe (node, safe, l1)
+                q_release_element(list_entry(node, element_t, list));
+            INIT_LIST_HEAD(l1);
+            INIT_LIST_HEAD(l2);
+        }
+    }
+
+    list_splice_tail(&result, l1);
+    return n;
+}
+
+static int q_set_op(struct list_head *a,
+                    struct list_head *b,
+                    bool descend,
+                    set_op_t op)
+{
+    if (!a || !b)
+        return 0;
+
+    normalize(queue_of(a));
+    normalize(queue_of(b));
+    q_invalidate(a);
+    q_invalidate(b);
+
+    /* A queue holds the same strings as itself, so merging it with itself
+     * keeps each string once, except that the difference keeps nothing.
+     * Those are the union and the intersection with an empty list.
+     */
+    LIST_HEAD(none);
+    if (a == b) {
+        b = &none;
+        op = op == SET_DIFFERENCE ? SET_INTERSECT : SET_UNION;
+    }
+    int n = merge_lists_set(a, b, descend, op);
+    queue_of(a)->ordered = !descend;
+    return n;
+}
+
+/* Merge two sorted queues into their set union */
+int q_union(struct list_head *a, struct list_head *b, bool descend)
+{
+    return q_set_op(a, b, descend, SET_UNION);
+}
+
+/* Merge two sorted queues into their set intersection */
+int q_intersect(struct list_head *a, struct list_head *b, bool descend)
+{
+    return q_set_op(a, b, descend, SET_INTERSECT);
+}
+
+/* Merge two sorted queues into their set difference */
+int q_difference(struct list_head *a, struct list_head *b, bool descend)
+{
+    return q_set_op(a, b, descend, SET_DIFFERENCE);
+}
+
+/* Cut a queue into k queues, the inverse of q_merge */
+bool q_split(struct list_head *head,
+             struct list_head *parts[],
+             int k,
+             bool round_robin)
+{
+    if (!head || k < 1 || (k > 1 && !parts))
+        return false;
+
+    queue_t *q = queue_of(head);
+    normalize(q);
+    bool ordered = q->ordered;
+    q_invalidate(head);
+    for (int i = 0; i < k - 1; i++) {
+        normalize(queue_of(parts[i]));
+        q_invalidate(parts[i]);
+    }
+
+    if (round_robin) {
+        struct list_head *node, *safe;
+        int i = 0;
+        list_for_each_safe (node, safe, head) {
+            if (i)
+                list_move_tail(node, parts[i - 1]);
+            if (++i == k)
+                i = 0;
+        }
+    } else {
+        int n = q_size(head);
+        LIST_HEAD(first);
+        for (int i = 0; i < k; i++) {
+            int len = n / k + (i < n % k);
+            if (!len)
+                break;
+
+            LIST_HEAD(run);
+            struct list_head *last = head;
+            while (len--)
+                last = last->next;
+            list_cut_position(&run, head, last);
+            list_splice_tail(&run, i ? parts[i - 1] : &first);
+        }
+        list_splice(&first, head);
+    }
+
+    /* Every share is a subsequence, so an ascending queue stays ascending */
+    q->ordered = ordered;
+    for (int i = 0; i < k - 1; i++)
+        queue_of(parts[i])->ordered = ordered;
+    return true;
+}
+
+/* Relocate elements and strings into one block in list order */
+bool q_compact(struct list_head *head)
+{
+    if (!head)
+        return false;
+    if (list_empty(head))
+        return true;
+
+    size_t n = 0, size = 0;
+    element_t *e, *safe;
+    list_for_each_entry (e, head, list) {
+        n++;
+        size += ARENA_ALIGN(sizeof(element_t));
+        if (!intern_has(e->value, e->hash))
+            size += ARENA_ALIGN(strlen(e->value) + 1);
+    }
+
+    arena_t *a = malloc(sizeof(arena_t) + size);
+    if (!a)
+        return false;
+    a->live = n;
+    a->size = size;
+    if (!arena_add(a)) {
+        free(a);
+        return false;
+    }
+
+    /* Interned strings stay shared, the reference moves to the copy */
+    LIST_HEAD(fresh);
+    char *p = a->data;
+    list_for_each_entry_safe (e, safe, head, list) {
+        element_t *copy = (element_t *) p;
+        p += ARENA_ALIGN(sizeof(element_t));
+        copy->hash = e->hash;
+        if (intern_has(e->value, e->hash)) {
+            copy->value = e->value;
+        } else {
+            size_t len = strlen(e->value) + 1;
+            copy->value = memcpy(p, e->value, len);
+            p += ARENA_ALIGN(len);
+            if (!arena_of(e->value))
+                free(e->value);
+        }
+        list_add_tail(&copy->list, &fresh);
+
+        arena_t *old = arena_of(e);
+        if (old)
+            arena_put(old);
+        else
+            free(e);
+    }
+    INIT_LIST_HEAD(head);
+    list_splice(&fresh, head);
+
+    /* Both indexes point at the old elements, the order is unchanged */
+    queue_t *q = queue_of(head);
+    q->rank.valid = false;
+    q->hash.valid = false;
+    return true;
+}
+
+/* File format of q_save() and q_load(), in host byte order: a header, an
+ * index of count offsets into the string table, then the table itself. Each
+ * table entry holds the length and hash of a string followed by the string
+ * and its terminating NUL, padded to 8 bytes. Loading needs no parsing: the
+ * table is copied into memory as a whole and elements point into the copy.
+ * The stored hashes come from str_hash(), so changing it takes a new version.
+ */
+#define QFILE_MAGIC 0x5130424cU /* "LB0Q" */
+#define QFILE_VERSION 1
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t count;
+    uint64_t table_size;
+} qfile_header_t;
+
+typedef struct {
+    uint32_t len;
+    uint32_t hash;
+    char str[];
+} qfile_entry_t;
+
+#define QFILE_ENTRY_SIZE(len) \
+    ((sizeof(qfile_entry_t) + (len) + 1 + 7) & ~(uint64_t) 7)
+
+/* Write the strings of queue to a file in list order */
+bool q_save(struct list_head *head, const char *path)
+{
+    if (!head || !path)
+        return false;
+
+    queue_t *q = queue_of(head);
+    qfile_header_t header = {QFILE_MAGIC, QFILE_VERSION, 0, 0};
+    struct list_head *node;
+    for (node = next_of(q, head); node != head; node = next_of(q, node)) {
+        element_t *e = list_entry(node, element_t, list);
+        header.count++;
+        header.table_size += QFILE_ENTRY_SIZE(strlen(e->value));
+    }
+
+    FILE *file = fopen(path, "wb");
+    if (!file)
+        return false;
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    uint64_t offset = 0;
+    for (node = next_of(q, head); ok && node != head;
+         node = next_of(q, node)) {
+        element_t *e = list_entry(node, element_t, list);
+        ok = fwrite(&offset, sizeof(offset), 1, file) == 1;
+        offset += QFILE_ENTRY_SIZE(strlen(e->value));
+    }
+
+    static const char pad[8];
+    for (node = next_of(q, head); ok && node != head;
+         node = next_of(q, node)) {
+        element_t *e = list_entry(node, element_t, list);
+        size_t len = strlen(e->value);
+        qfile_entry_t entry = {len, e->hash};
+        size_t size = QFILE_ENTRY_SIZE(len) - sizeof(entry) - len;
+        ok = fwrite(&entry, sizeof(entry), 1, file) == 1 &&
+             fwrite(e->value, 1, len, file) == len &&
+             fwrite(pad, 1, size, file) == size;
+    }
+
+    if (fclose(file))
+        ok = false;
+    return ok;
+}
+
+/* Check that the index and every entry it refers to lie within the file */
+static bool qfile_check(const char *map, size_t size)
+{
+    const qfile_header_t *header = (const qfile_header_t *) map;
+    if (size < sizeof(*header) || header->magic != QFILE_MAGIC ||
+        header->version != QFILE_VERSION ||
+        header->count > (size - sizeof(*header)) / sizeof(uint64_t) ||
+        header->table_size != size - sizeof(*header) -
+                                  header->count * sizeof(uint64_t))
+        return false;
+
+    const uint64_t *index = (const uint64_t *) (header + 1);
+    const char *table = (const char *) (index + header->count);
+    for (uint64_t i = 0; i < header->count; i++) {
+        if (index[i] % 8 || index[i] > header->table_size ||
+            header->table_size - index[i] < sizeof(qfile_entry_t))
+            return false;
+        const qfile_entry_t *entry = (const qfile_entry_t *) (table + index[i]);
+        if (header->table_size - index[i] < QFILE_ENTRY_SIZE(entry->len) ||
+            entry->str[entry->len])
+            return false;
+    }
+    return true;
+}
+
+/* Map a file written by q_save() and check it, NULL if it is not one */
+static char *qfile_map(const char *path, size_t *size, struct stat *st)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, st) || st->st_size < (off_t) sizeof(qfile_header_t)) {
+        close(fd);
+        return NULL;
+    }
+    *size = st->st_size;
+    char *map = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    if (!qfile_check(map, *size)) {
+        munmap(map, *size);
+        return NULL;
+    }
+    return map;
+}
+
+/* Append the strings saved in a file to the tail of queue */
+int q_load(struct list_head *head, const char *path)
+{
+    if (!head || !path)
+        return -1;
+
+    size_t size;
+    struct stat st;
+    char *map = qfile_map(path, &size, &st);
+    if (!map)
+        return -1;
+
+    const qfile_header_t *header = (const qfile_header_t *) map;
+    if (header->count > INT_MAX) {
+        munmap(map, size);
+        return -1;
+    }
+    int count = header->count;
+    if (!count) {
+        munmap(map, size);
+        return 0;
+    }
+
+    /* Interned strings are shared with the intern table, not copied */
+    queue_t *q = queue_of(head);
+    bool intern = q->mode & Q_MODE_INTERN;
+    size_t elems = count * sizeof(element_t);
+    size_t table_size = intern ? 0 : header->table_size;
+    arena_t *a = malloc(sizeof(arena_t) + elems + table_size);
+    if (!a) {
+        munmap(map, size);
+        return -1;
+    }
+    a->live = count;
+    a->size = elems + table_size;
+    if (!arena_add(a)) {
+        free(a);
+        munmap(map, size);
+        return -1;
+    }
+
+    const uint64_t *index = (const uint64_t *) (header + 1);
+    const char *table = (const char *) (index + count);
+    char *copy = a->data + elems;
+    if (!intern)
+        memcpy(copy, table, table_size);
+
+    LIST_HEAD(loaded);
+    element_t *e = (element_t *) a->data;
+    for (int i = 0; i < count; i++, e++) {
+        const qfile_entry_t *entry = (const qfile_entry_t *) (table + index[i]);
+        e->hash = entry->hash;
+        if (!intern) {
+            e->value = copy + index[i] + sizeof(qfile_entry_t);
+        } else if (!(e->value = intern_get(entry->str, entry->hash))) {
+            /* Hand back what was taken so far, the arena goes with it */
+            a->live = i + 1;
+            arena_put(a);
+            element_t *safe;
+            list_for_each_entry_safe (e, safe, &loaded, list)
+                q_release_element(e);
+            munmap(map, size);
+            return -1;
+        }
+        list_add_tail(&e->list, &loaded);
+    }
+    munmap(map, size);
+
+    normalize(q);
+    list_splice_tail(&loaded, head);
+    q_invalidate(head);
+    return count;
+}
+
+/* External merge sort of q_save() files. Runs are written to temporary files
+ * as a stream of records, each a qfile_entry_t header followed by the string
+ * without its NUL, and read back one record at a time while merging.
+ */
+typedef struct {
+    FILE *file;
+    char *buf; /* current string, NUL terminated */
+    size_t cap;
+    qfile_entry_t entry;
+    size_t index; /* position of the run in the input, breaks ties */
+} run_reader_t;
+
+/* Compare entries by string, then by position to keep the sort stable */
+static bool sort_descend;
+
+static int entry_cmp(const void *a, const void *b)
+{
+    const qfile_entry_t *x = *(const qfile_entry_t *const *) a;
+    const qfile_entry_t *y = *(const qfile_entry_t *const *) b;
+    int r = strcmp(x->str, y->str);
+    if (r)
+        return sort_descend ? -r : r;
+    return (uintptr_t) x < (uintptr_t) y ? -1 : (uintptr_t) x > (uintptr_t) y;
+}
+
+/* Read the next record of a run, false at its end or on error */
+static bool run_next(run_reader_t *r)
+{
+    if (fread(&r->entry, sizeof(r->entry), 1, r->file) != 1)
+        return false;
+    if (r->entry.len >= r->cap) {
+        size_t cap = r->cap ? r->cap : 64;
+        while (cap <= r->entry.len)
+            cap *= 2;
+        char *buf = malloc(cap);
+        if (!buf)
+            return false;
+        free(r->buf);
+        r->buf = buf;
+        r->cap = cap;
+    }
+    if (fread(r->buf, 1, r->entry.len, r->file) != r->entry.len)
+        return false;
+    r->buf[r->entry.len] = '\0';
+    return true;
+}
+
+static bool run_after(const run_reader_t *a, const run_reader_t *b)
+{
+    int r = strcmp(a->buf, b->buf);
+    if (sort_descend)
+        r = -r;
+    return r > 0 || (!r && a->index > b->index);
+}
+
+static void run_sift_down(run_reader_t **heap, size_t n, size_t i)
+{
+    for (;;) {
+        size_t min = i, l = 2 * i + 1, r = l + 1;
+        if (l < n && run_after(heap[min], heap[l]))
+            min = l;
+        if (r < n && run_after(heap[min], heap[r]))
+            min = r;
+        if (min == i)
+            return;
+        run_reader_t *tmp = heap[i];
+        heap[i] = heap[min];
+        heap[min] = tmp;
+        i = min;
+    }
+}
+
+/* Writer of a q_save() file whose entries arrive one at a time: the index
+ * and the table are written through two streams on the same file.
+ */
+typedef struct {
+    FILE *index, *table;
+    uint64_t offset;
+} qfile_writer_t;
+
+static bool qfile_write_entry(qfile_writer_t *w,
+                              const qfile_entry_t *entry,
+                              const char *str)
+{
+    static const char pad[8];
+    size_t size = QFILE_ENTRY_SIZE(entry->len) - sizeof(*entry) - entry->len;
+    bool ok = fwrite(&w->offset, sizeof(w->offset), 1, w->index) == 1 &&
+              fwrite(entry, sizeof(*entry), 1, w->table) == 1 &&
+              fwrite(str, 1, entry->len, w->table) == entry->len &&
+              fwrite(pad, 1, size, w->table) == size;
+    w->offset += QFILE_ENTRY_SIZE(entry->len);
+    return ok;
+}
+
+/* Sort a file written by q_save() within a memory budget */
+bool q_sort_file(const char *in, const char *out, size_t budget, bool descend)
+{
+    if (!in || !out)
+        return false;
+
+    size_t size;
+    struct stat st, out_st;
+    char *map = qfile_map(in, &size, &st);
+    if (!map)
+        return false;
+    /* Truncating the mapped input would take the pages away from under us */
+    if (!stat(out, &out_st) && out_st.st_dev == st.st_dev &&
+        out_st.st_ino == st.st_ino) {
+        munmap(map, size);
+        return false;
+    }
+
+    const qfile_header_t *header = (const qfile_header_t *) map;
+    const uint64_t *index = (const uint64_t *) (header + 1);
+    const char *table = (const char *) (index + header->count);
+    sort_descend = descend;
+
+    /* A chunk holds as many entries as fit in the budget along with their
+     * pointers, and is sorted as an array of pointers into the mapping.
+     */
+    size_t chunk_cap = budget / sizeof(qfile_entry_t *);
+    if (chunk_cap > header->count)
+        chunk_cap = header->count;
+    if (chunk_cap < 2)
+        chunk_cap = 2;
+    const qfile_entry_t **chunk = malloc(chunk_cap * sizeof(*chunk));
+    run_reader_t *runs = NULL;
+    run_reader_t **heap = NULL;
+    size_t nruns = 0, runs_cap = 0;
+    qfile_writer_t w = {NULL, NULL, 0};
+    bool ok = chunk;
+
+    uint64_t i = 0;
+    while (ok && i < header->count) {
+        size_t n = 0, bytes = 0;
+        for (; i < header->count && n < chunk_cap; i++, n++) {
+            const qfile_entry_t *e = (const qfile_entry_t *) (table + index[i]);
+            bytes += sizeof(*chunk) + QFILE_ENTRY_SIZE(e->len);
+            if (n && bytes > budget)
+                break;
+            chunk[n] = e;
+        }
+        qsort(chunk, n, sizeof(*chunk), entry_cmp);
+
+        if (nruns == runs_cap) {
+            size_t cap = runs_cap ? runs_cap * 2 : 8;
+            run_reader_t *tmp = malloc(cap * sizeof(run_reader_t));
+            if (!tmp) {
+                ok = false;
+                break;
+            }
+            if (nruns)
+                memcpy(tmp, runs, nruns * sizeof(run_reader_t));
+            free(runs);
+            runs = tmp;
+            runs_cap = cap;
+        }
+        run_reader_t *r = &runs[nruns];
+        memset(r, 0, sizeof(*r));
+        r->index = nruns;
+        r->file = tmpfile();
+        if (!r->file) {
+            ok = false;
+            break;
+        }
+        nruns++;
+        for (size_t j = 0; ok && j < n; j++) {
+            ok = fwrite(chunk[j], sizeof(qfile_entry_t), 1, r->file) == 1 &&
+                 fwrite(chunk[j]->str, 1, chunk[j]->len, r->file) ==
+                     chunk[j]->len;
+        }
+        ok = ok && !fflush(r->file);
+    }
+    free(chunk);
+
+    /* Merge the runs into the output through a heap of their next records */
+    if (ok) {
+        heap = malloc((nruns ? nruns : 1) * sizeof(*heap));
+        w.table = fopen(out, "wb");
+        w.index = w.table ? fopen(out, "r+b") : NULL;
+        ok = heap && w.index &&
+             fwrite(header, sizeof(*header), 1, w.table) == 1 &&
+             !fseek(w.index, sizeof(*header), SEEK_SET) &&
+             !fseek(w.table,
+                    sizeof(*header) + header->count * sizeof(uint64_t),
+                    SEEK_SET);
+    }
+    size_t n = 0;
+    for (size_t j = 0; ok && j < nruns; j++) {
+        run_reader_t *r = &runs[j];
+        ok = !fseek(r->file, 0, SEEK_SET);
+        if (ok && run_next(r))
+            heap[n++] = r;
+    }
+    for (size_t j = n / 2; ok && j-- > 0;)
+        run_sift_down(heap, n, j);
+    while (ok && n) {
+        run_reader_t *r = heap[0];
+        ok = qfile_write_entry(&w, &r->entry, r->buf);
+        if (!run_next(r))
+            heap[0] = heap[--n];
+        run_sift_down(heap, n, 0);
+    }
+    ok = ok && w.offset == header->table_size;
+
+    if (w.index && fclose(w.index))
+        ok = false;
+    if (w.table && fclose(w.table))
+        ok = false;
+    if (!ok && w.table)
+        unlink(out);
+    for (size_t j = 0; j < nruns; j++) {
+        fclose(runs[j].file);
+        free(runs[j].buf);
+    }
+    free(runs);
+    free(heap);
+    munmap(map, size);
+    return ok;
+}
+
 #define element_next(pos, member) \
     list_entry((pos)->member.next, typeof(*(pos)), member)
 
@@ -447,10 +2436,15 @@ int q_merge(struct list_head *head, bool descend)
                    *next;
     struct list_head *curr = entry->q;
 
+    normalize(queue_of(curr));
+    q_invalidate(curr);
     for (next = element_next(entry, chain); &next->chain != head;
          next = element_next(next, chain)) {
+        normalize(queue_of(next->q));
         merge_lists_with_sentinel_node(curr, next->q, descend);
+        q_invalidate(next->q);
     }
+    queue_of(curr)->ordered = !descend;
 
     return q_size(entry->q);
 }
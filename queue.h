@@ -9,6 +9,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include "harness.h"
 #include "list.h"
@@ -16,12 +17,14 @@
 /**
  * element_t - Linked list element
  * @value: pointer to array holding string
+ * @hash: hash of @value, computed once when the element is created
  * @list: node of a doubly-linked list
  *
  * @value needs to be explicitly allocated and freed
  */
 typedef struct {
     char *value;
+    uint32_t hash;
     struct list_head list;
 } element_t;
 
@@ -39,6 +42,23 @@ typedef struct {
     int id;
 } queue_contex_t;
 
+/* Optional queue modes, combined with bitwise OR and passed to q_set_mode() */
+
+/* Keep an order-statistics index for O(log n) positional access */
+#define Q_MODE_INDEX (1U << 0)
+
+/* Keep elements in ascending order for O(log n) q_insert_sorted() */
+#define Q_MODE_SORTED (1U << 1)
+
+/* Share one reference-counted copy among equal strings, see q_insert_head() */
+#define Q_MODE_INTERN (1U << 2)
+
+/* Keep a hash index of values for O(1) q_find() and q_remove_value() */
+#define Q_MODE_HASH (1U << 3)
+
+/* Make q_reverse() O(1) by flipping a direction flag, see q_is_reversed() */
+#define Q_MODE_LAZY_REVERSE (1U << 4)
+
 /* Operations on queue */
 
 /**
@@ -54,6 +74,49 @@ struct list_head *q_new();
  */
 void q_free(struct list_head *head);
 
+/**
+ * q_set_mode() - Select optional features of a queue
+ * @head: header of queue, as returned by q_new()
+ * @mode: bitwise OR of Q_MODE_* flags, zero for a plain queue
+ *
+ * Auxiliary structures behind a mode are built lazily the first time an
+ * operation needs them, so switching a mode on is cheap even for a long queue.
+ *
+ * Return: true for success, false if queue is NULL
+ */
+bool q_set_mode(struct list_head *head, unsigned int mode);
+
+/**
+ * q_get_mode() - Get the optional features of a queue
+ * @head: header of queue
+ *
+ * Return: bitwise OR of Q_MODE_* flags, zero if queue is NULL
+ */
+unsigned int q_get_mode(struct list_head *head);
+
+/**
+ * q_invalidate() - Drop cached auxiliary structures of a queue
+ * @head: header of queue
+ *
+ * Queue operations keep their own indexes up to date. Call this after
+ * relinking the nodes of a queue directly with the list_* helpers, so that
+ * stale indexes are rebuilt from the list on next use.
+ */
+void q_invalidate(struct list_head *head);
+
+/**
+ * q_is_reversed() - Check the direction of a queue
+ * @head: header of queue
+ *
+ * With Q_MODE_LAZY_REVERSE, q_reverse() only flips a flag and the nodes are
+ * relinked later, by the first operation that needs them in order. Until
+ * then, the head of the queue is the last node of the list. Callers walking
+ * the list themselves have to follow @prev instead of @next in that case.
+ *
+ * Return: true if the queue runs from @head->prev to @head->next
+ */
+bool q_is_reversed(struct list_head *head);
+
 /**
  * q_insert_head() - Insert an element in the head
  * @head: header of queue
@@ -62,6 +125,11 @@ void q_free(struct list_head *head);
  * Argument s points to the string to be stored.
  * The function must explicitly allocate space and copy the string into it.
  *
+ * A Q_MODE_INTERN queue is the one exception: elements holding equal strings
+ * then share a single reference-counted copy from a global intern table, and
+ * comparing two such strings for equality is a pointer comparison. The copy
+ * is still never @s itself, and q_release_element() drops the reference.
+ *
  * Return: true for success, false for allocation failed or queue is NULL
  */
 bool q_insert_head(struct list_head *head, char *s);
@@ -78,6 +146,23 @@ bool q_insert_head(struct list_head *head, char *s);
  */
 bool q_insert_tail(struct list_head *head, char *s);
 
+/**
+ * q_insert_sorted() - Insert an element while keeping ascending order
+ * @head: header of queue
+ * @s: string would be inserted
+ *
+ * Argument s points to the string to be stored.
+ * The function must explicitly allocate space and copy the string into it.
+ * The new element goes after any element holding an equal string, so
+ * insertion order is kept among duplicates. A queue which is not in
+ * ascending order is sorted first.
+ *
+ * Takes O(log n) time with Q_MODE_SORTED, otherwise walks the list.
+ *
+ * Return: true for success, false for allocation failed or queue is NULL
+ */
+bool q_insert_sorted(struct list_head *head, char *s);
+
 /**
  * q_remove_head() - Remove the element from head of queue
  * @head: header of queue
@@ -112,13 +197,11 @@ element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize);
  * q_release_element() - Release the element
  * @e: element would be released
  *
- * This function is intended for internal use only.
+ * An interned string is only freed along with its last reference, and an
+ * element relocated by q_compact() along with the last element sharing its
+ * block. This function is intended for internal use only.
  */
-static inline void q_release_element(element_t *e)
-{
-    test_free(e->value);
-    test_free(e);
-}
+void q_release_element(element_t *e);
 
 /**
  * q_size() - Get the size of the queue
@@ -135,6 +218,7 @@ int q_size(struct list_head *head);
  * The middle node of a linked list of size n is the
  * ⌊n / 2⌋th node from the start using 0-based indexing.
  * If there're six elements, the third member should be deleted.
+ * With Q_MODE_INDEX the node is located through the index in O(log n).
  *
  * Reference:
  * https://leetcode.com/problems/delete-the-middle-node-of-a-linked-list/
@@ -143,6 +227,69 @@ int q_size(struct list_head *head);
  */
 bool q_delete_mid(struct list_head *head);
 
+/**
+ * q_get() - Get the element at a given position
+ * @head: header of queue
+ * @index: 0-based position from the head of queue
+ *
+ * Takes O(log n) time with Q_MODE_INDEX, otherwise walks the list.
+ *
+ * Return: the pointer to element, %NULL if queue is NULL or @index is out of
+ * range.
+ */
+element_t *q_get(struct list_head *head, int index);
+
+/**
+ * q_insert_at() - Insert an element at a given position
+ * @head: header of queue
+ * @index: 0-based position the new element will occupy, from 0 to q_size()
+ * @s: string would be inserted
+ *
+ * Argument s points to the string to be stored.
+ * The function must explicitly allocate space and copy the string into it.
+ * Takes O(log n) time with Q_MODE_INDEX, otherwise walks the list.
+ *
+ * Return: true for success, false for allocation failed, queue is NULL or
+ * @index is out of range
+ */
+bool q_insert_at(struct list_head *head, int index, char *s);
+
+/**
+ * q_delete_at() - Delete the element at a given position
+ * @head: header of queue
+ * @index: 0-based position from the head of queue
+ *
+ * Takes O(log n) time with Q_MODE_INDEX, otherwise walks the list.
+ *
+ * Return: true for success, false if queue is NULL or @index is out of range.
+ */
+bool q_delete_at(struct list_head *head, int index);
+
+/**
+ * q_find() - Find the first element holding a given string
+ * @head: header of queue
+ * @s: string to look for
+ *
+ * Takes O(1) expected time with Q_MODE_HASH, otherwise walks the list.
+ *
+ * Return: the first element from the head whose value equals @s, %NULL if
+ * there is none or queue is NULL.
+ */
+element_t *q_find(struct list_head *head, char *s);
+
+/**
+ * q_remove_value() - Remove the first element holding a given string
+ * @head: header of queue
+ * @s: string to look for
+ *
+ * As with q_remove_head(), the element is only unlinked and the caller is
+ * responsible for releasing it. Takes O(1) expected time with Q_MODE_HASH,
+ * otherwise walks the list.
+ *
+ * Return: the removed element, %NULL if there is none or queue is NULL.
+ */
+element_t *q_remove_value(struct list_head *head, char *s);
+
 /**
  * q_delete_dup() - Delete all nodes that have duplicate string,
  *                  leaving only distinct strings from the original queue.
@@ -155,6 +302,20 @@ bool q_delete_mid(struct list_head *head);
  */
 bool q_delete_dup(struct list_head *head);
 
+/**
+ * q_delete_dup_unsorted() - Delete all nodes whose string appears more than
+ *                           once anywhere in queue
+ * @head: header of queue
+ *
+ * Unlike q_delete_dup(), the queue does not need to be sorted: duplicates are
+ * found with a hash set keyed by the hash stored in each element, in O(n)
+ * expected time. The remaining elements keep their relative order.
+ *
+ * Return: true for success, false if list is NULL or empty, or the hash set
+ * could not be allocated.
+ */
+bool q_delete_dup_unsorted(struct list_head *head);
+
 /**
  * q_swap() - Swap every two adjacent nodes
  * @head: header of queue
@@ -172,6 +333,8 @@ void q_swap(struct list_head *head);
  * This function should not allocate or free any list elements
  * (e.g., by calling q_insert_head, q_insert_tail, or q_remove_head).
  * It should rearrange the existing ones.
+ *
+ * Takes O(1) time with Q_MODE_LAZY_REVERSE, see q_is_reversed().
  */
 void q_reverse(struct list_head *head);
 
@@ -196,10 +359,44 @@ void q_reverseK(struct list_head *head, int k);
  * @descend: whether or not to sort in descending order
  *
  * No effect if queue is NULL or empty. If there has only one element, do
- * nothing.
+ * nothing. A Q_MODE_SORTED queue which is still in order makes sorting in
+ * ascending order a no-op.
  */
 void q_sort(struct list_head *head, bool descend);
 
+/**
+ * q_topk() - Move the k smallest or largest elements to the front of queue
+ * @head: header of queue
+ * @k: number of elements to select
+ * @descend: whether to select the largest elements instead of the smallest
+ *
+ * The selected elements end up at the front of queue in the order q_sort()
+ * would give them, and the rest follow in their original relative order.
+ * Among equal strings, earlier elements are selected first. A bounded heap of
+ * k entries is kept during a single pass over the queue, which takes
+ * O(n log k) time instead of the O(n log n) of sorting the whole queue.
+ *
+ * Return: true for success, false if queue is NULL, @k is negative or the
+ * heap could not be allocated.
+ */
+bool q_topk(struct list_head *head, int k, bool descend);
+
+/**
+ * q_nth() - Find the n-th smallest element of queue
+ * @head: header of queue
+ * @n: 0-based rank of the element, e.g. q_size() / 2 for the median
+ *
+ * Partitions the queue in place as a side effect: the element found ends up
+ * at position @n, with no greater element before it and no smaller one after
+ * it. Uses quickselect around sampled pivots, falling back to the median of
+ * medians after unbalanced splits, for O(n) expected and worst-case time. No
+ * memory is allocated. A Q_MODE_SORTED queue which is still in order is left
+ * untouched, and answers in O(log n) time while its index is up to date.
+ *
+ * Return: the element, %NULL if queue is NULL or @n is out of range.
+ */
+element_t *q_nth(struct list_head *head, int n);
+
 /**
  * q_ascend() - Delete every node which has a node with a strictly less
  * value anywhere to the right side of it.
@@ -250,4 +447,125 @@ int q_descend(struct list_head *head);
  */
 int q_merge(struct list_head *head, bool descend);
 
+/**
+ * q_union() - Merge two sorted queues into their set union
+ * @a: header of the first queue, which receives the result
+ * @b: header of the second queue, left empty
+ * @descend: whether the queues are sorted in descending order
+ *
+ * Both queues have to be sorted in the same order. A single merge pass moves
+ * the nodes of @a and @b into @a, keeping one node for each distinct string
+ * and releasing the others. The result is sorted as well. @a and @b may be
+ * the same queue. Allocation is disallowed in this function.
+ *
+ * Return: the number of elements in @a after the operation
+ */
+int q_union(struct list_head *a, struct list_head *b, bool descend);
+
+/**
+ * q_intersect() - Merge two sorted queues into their set intersection
+ * @a: header of the first queue, which receives the result
+ * @b: header of the second queue, left empty
+ * @descend: whether the queues are sorted in descending order
+ *
+ * As q_union(), but only strings found in both queues are kept, once each.
+ *
+ * Return: the number of elements in @a after the operation
+ */
+int q_intersect(struct list_head *a, struct list_head *b, bool descend);
+
+/**
+ * q_difference() - Merge two sorted queues into their set difference
+ * @a: header of the first queue, which receives the result
+ * @b: header of the second queue, left empty
+ * @descend: whether the queues are sorted in descending order
+ *
+ * As q_union(), but only strings of @a which are not found in @b are kept,
+ * once each. The difference of a queue with itself is empty.
+ *
+ * Return: the number of elements in @a after the operation
+ */
+int q_difference(struct list_head *a, struct list_head *b, bool descend);
+
+/**
+ * q_split() - Cut a queue into k queues, the inverse of q_merge()
+ * @head: header of queue, which keeps the first share
+ * @parts: headers of k - 1 empty queues receiving the other shares
+ * @k: number of shares
+ * @round_robin: whether to deal elements out in turn instead of cutting
+ *
+ * Without @round_robin, the queue is cut into k contiguous runs whose sizes
+ * differ by at most one, the longer runs coming first. With it, the i-th
+ * element goes to share i mod k. Either way, elements keep their relative
+ * order and are moved, not copied. No allocation is done.
+ *
+ * Return: true for success, false if queue is NULL or k is not positive.
+ */
+bool q_split(struct list_head *head,
+             struct list_head *parts[],
+             int k,
+             bool round_robin);
+
+/**
+ * q_compact() - Relocate elements into list order for traversal locality
+ * @head: header of queue
+ *
+ * Copy every element and its string into one freshly allocated block, in the
+ * current list order, each string right after its element, then release the
+ * old elements. Walking the queue afterwards reads memory sequentially. The
+ * queue keeps its order and its strings; only the element addresses change.
+ * Interned strings stay shared and are not copied.
+ *
+ * The block is freed once all its elements have been released, which is why
+ * elements must only be released through q_release_element().
+ *
+ * Return: true for success, false for allocation failed or queue is NULL.
+ */
+bool q_compact(struct list_head *head);
+
+/**
+ * q_save() - Write the strings of queue to a file
+ * @head: header of queue
+ * @path: name of the file, which is created or truncated
+ *
+ * The file holds a table of length-prefixed strings in list order, along
+ * with an index of their offsets, so that q_load() can map it and use it
+ * without parsing.
+ *
+ * Return: true for success, false if queue is NULL or writing failed.
+ */
+bool q_save(struct list_head *head, const char *path);
+
+/**
+ * q_load() - Append the strings saved in a file to the tail of queue
+ * @head: header of queue
+ * @path: name of a file written by q_save()
+ *
+ * The file is mapped into memory and its string table copied as a whole into
+ * one block along with the new elements, in the same way as q_compact()
+ * lays them out. Elements then point into the copy, so no string is copied
+ * on its own, except for queues interning their strings.
+ *
+ * Return: the number of elements appended, -1 if queue is NULL, the file
+ * could not be read or is not in the right format, or allocation failed.
+ */
+int q_load(struct list_head *head, const char *path);
+
+/**
+ * q_sort_file() - Sort the strings saved in a file within a memory budget
+ * @in: name of a file written by q_save()
+ * @out: name of the sorted file to write, which must not be @in
+ * @budget: number of bytes the strings being sorted may take in memory
+ * @descend: whether to sort in descending order
+ *
+ * An external merge sort for data sets that do not fit in memory: the input
+ * is mapped and cut into chunks fitting in @budget, each of which is sorted
+ * and written to a temporary file as a run. The runs are then merged into
+ * @out, which can be read back with q_load(). The sort is stable.
+ *
+ * Return: true for success, false if a file could not be read or written or
+ * allocation failed.
+ */
+bool q_sort_file(const char *in, const char *out, size_t budget, bool descend);
+
 #endif /* LAB0_QUEUE_H */
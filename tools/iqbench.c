@@ -0,0 +1,304 @@
+/* Compare the compact index-linked queue of iqueue.c with a queue laid out
+ * like queue.h, where every element is an allocated node pointing to an
+ * allocated string.
+ *
+ * Both queues are filled with the same random strings, then sorted in two
+ * halves, merged, reversed and walked. Memory is the arena for iqueue, and
+ * the usable size plus chunk header of every block for the pointer layout.
+ *
+ * Usage: iqbench [number of elements, 10000000 by default]
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <malloc.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "iqueue.h"
+#include "list.h"
+
+#define MIN_LEN 5
+#define MAX_LEN 10
+
+/* Node of the pointer layout, element_t without its optional indexes */
+typedef struct {
+    char *value;
+    struct list_head list;
+} pnode_t;
+
+typedef struct {
+    double insert, sort, merge, reverse, walk;
+    size_t bytes;
+} result_t;
+
+static char *strings;
+static size_t count;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static char *string_at(size_t i)
+{
+    return &strings[i * (MAX_LEN + 1)];
+}
+
+static void make_strings(void)
+{
+    uint64_t x = 0x9e3779b97f4a7c15ULL;
+    strings = malloc(count * (MAX_LEN + 1));
+    if (!strings) {
+        fprintf(stderr, "Could not allocate %zu strings\n", count);
+        exit(1);
+    }
+    for (size_t i = 0; i < count; i++) {
+        char *s = string_at(i);
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        int len = MIN_LEN + x % (MAX_LEN - MIN_LEN + 1);
+        for (int j = 0; j < len; j++)
+            s[j] = 'a' + (x >> (8 + 2 * j)) % 26;
+        s[len] = '\0';
+    }
+}
+
+/* Block size as glibc accounts it, chunk header included */
+static size_t block_bytes(void *p)
+{
+    return malloc_usable_size(p) + sizeof(size_t);
+}
+
+static bool iq_sorted(const iqueue_t *q, bool descend)
+{
+    uint32_t i = iq_first(q);
+    if (!i)
+        return true;
+    for (uint32_t next; (next = iq_next(q, i)); i = next) {
+        int cmp = strcmp(iq_value(q, i), iq_value(q, next));
+        if (descend ? cmp < 0 : cmp > 0)
+            return false;
+    }
+    return true;
+}
+
+static bool run_iqueue(result_t *r)
+{
+    iqueue_t *a = iq_new(), *b = iq_new();
+    if (!a || !b)
+        return false;
+
+    double t = now();
+    for (size_t i = 0; i < count; i++) {
+        if (!iq_insert_tail(i < count / 2 ? a : b, string_at(i)))
+            return false;
+    }
+    r->insert = now() - t;
+    r->bytes = iq_bytes(a) + iq_bytes(b);
+
+    t = now();
+    iq_sort(a, false);
+    iq_sort(b, false);
+    r->sort = now() - t;
+
+    t = now();
+    if (!iq_merge(a, b, false))
+        return false;
+    r->merge = now() - t;
+    bool ok = iq_size(a) == count && iq_sorted(a, false);
+
+    t = now();
+    iq_reverse(a);
+    r->reverse = now() - t;
+    ok = ok && iq_sorted(a, true);
+
+    t = now();
+    size_t len = 0;
+    for (uint32_t i = iq_first(a); i; i = iq_next(a, i))
+        len += strlen(iq_value(a, i));
+    r->walk = now() - t;
+
+    iq_free(a);
+    iq_free(b);
+    return ok && len;
+}
+
+static inline const char *pvalue(struct list_head *node)
+{
+    return list_entry(node, pnode_t, list)->value;
+}
+
+/* The bottom-up merge sort of iq_sort() over pointer links */
+static struct list_head *pmerge(struct list_head *a, struct list_head *b)
+{
+    struct list_head *head = NULL, **tail = &head;
+    while (a && b) {
+        if (strcmp(pvalue(a), pvalue(b)) <= 0) {
+            *tail = a;
+            tail = &a->next;
+            a = a->next;
+        } else {
+            *tail = b;
+            tail = &b->next;
+            b = b->next;
+        }
+    }
+    *tail = a ? a : b;
+    return head;
+}
+
+static void psort(struct list_head *head)
+{
+    if (list_empty(head) || list_is_singular(head))
+        return;
+
+    struct list_head *pending[64] = {NULL};
+    head->prev->next = NULL;
+    for (struct list_head *node = head->next, *next; node; node = next) {
+        next = node->next;
+        node->next = NULL;
+
+        struct list_head *run = node;
+        int k = 0;
+        for (; pending[k]; k++) {
+            run = pmerge(pending[k], run);
+            pending[k] = NULL;
+        }
+        pending[k] = run;
+    }
+
+    struct list_head *run = NULL;
+    for (int k = 0; k < 64; k++) {
+        if (pending[k])
+            run = run ? pmerge(pending[k], run) : pending[k];
+    }
+
+    struct list_head *prev = head;
+    for (struct list_head *node = run; node; node = node->next) {
+        node->prev = prev;
+        prev->next = node;
+        prev = node;
+    }
+    prev->next = head;
+    head->prev = prev;
+}
+
+/* Weave sorted list from into sorted list head, as q_merge() does */
+static void pmerge_lists(struct list_head *head, struct list_head *from)
+{
+    struct list_head *cur = head->next;
+    while (!list_empty(from)) {
+        struct list_head *node = from->next;
+        while (cur != head && strcmp(pvalue(node), pvalue(cur)) >= 0)
+            cur = cur->next;
+        list_move_tail(node, cur);
+    }
+}
+
+static bool psorted(struct list_head *head, bool descend)
+{
+    for (struct list_head *node = head->next;
+         node != head && node->next != head; node = node->next) {
+        int cmp = strcmp(pvalue(node), pvalue(node->next));
+        if (descend ? cmp < 0 : cmp > 0)
+            return false;
+    }
+    return true;
+}
+
+static bool run_pointer(result_t *r)
+{
+    LIST_HEAD(a);
+    LIST_HEAD(b);
+
+    double t = now();
+    for (size_t i = 0; i < count; i++) {
+        pnode_t *e = malloc(sizeof(pnode_t));
+        if (!e || !(e->value = strdup(string_at(i))))
+            return false;
+        list_add_tail(&e->list, i < count / 2 ? &a : &b);
+    }
+    r->insert = now() - t;
+
+    r->bytes = 0;
+    pnode_t *e, *safe;
+    list_for_each_entry (e, &a, list)
+        r->bytes += block_bytes(e) + block_bytes(e->value);
+    list_for_each_entry (e, &b, list)
+        r->bytes += block_bytes(e) + block_bytes(e->value);
+
+    t = now();
+    psort(&a);
+    psort(&b);
+    r->sort = now() - t;
+
+    t = now();
+    pmerge_lists(&a, &b);
+    r->merge = now() - t;
+    bool ok = psorted(&a, false);
+
+    t = now();
+    struct list_head *node = &a;
+    do {
+        struct list_head *next = node->next;
+        node->next = node->prev;
+        node->prev = next;
+        node = next;
+    } while (node != &a);
+    r->reverse = now() - t;
+    ok = ok && psorted(&a, true);
+
+    t = now();
+    size_t len = 0, n = 0;
+    list_for_each_entry (e, &a, list) {
+        len += strlen(e->value);
+        n++;
+    }
+    r->walk = now() - t;
+
+    list_for_each_entry_safe (e, safe, &a, list) {
+        free(e->value);
+        free(e);
+    }
+    return ok && n == count && len;
+}
+
+static void print_result(const char *name, const result_t *r)
+{
+    printf("%-8s %8.3f %8.3f %8.3f %8.3f %8.3f %10.1f\n", name, r->insert,
+           r->sort, r->merge, r->reverse, r->walk, (double) r->bytes / count);
+}
+
+int main(int argc, char *argv[])
+{
+    count = argc > 1 ? strtoull(argv[1], NULL, 10) : 10000000;
+    if (count < 2 || count > UINT32_MAX / 8) {
+        fprintf(stderr, "Number of elements out of range\n");
+        return 1;
+    }
+    make_strings();
+
+    result_t iq, ptr;
+    if (!run_iqueue(&iq) || !run_pointer(&ptr)) {
+        fprintf(stderr, "Benchmark failed\n");
+        return 1;
+    }
+
+    printf("%zu elements, times in seconds\n", count);
+    printf("%-8s %8s %8s %8s %8s %8s %10s\n", "layout", "insert", "sort",
+           "merge", "reverse", "walk", "bytes/elem");
+    print_result("iqueue", &iq);
+    print_result("pointer", &ptr);
+    free(strings);
+    return 0;
+}
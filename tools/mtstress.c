@@ -0,0 +1,173 @@
+/* Stress test of the per-thread heaps of harness.c.
+ *
+ * Waves of threads allocate blocks of random sizes with test_malloc(). Each
+ * block is either kept and freed by its owner, or swapped into a shared
+ * slot, whose previous block the swapping thread then frees. Most frees of
+ * shared blocks are therefore remote, and go through the remote stack of
+ * the owner until it drains them. Threads exit with their blocks still
+ * in the slots, so their heaps become orphans. Later waves free those blocks
+ * and adopt the orphaned heaps. The run creates more threads than there
+ * can be heaps, so it fails unless heaps are adopted.
+ *
+ * Each block holds its size in its first byte, followed by a byte derived
+ * from its address, and is checked before it is freed. After every pass,
+ * allocation_check() has to match the blocks left in the slots, and be zero
+ * once they are freed.
+ * Passes are run with the default settings, with a quarantine and in arena
+ * mode.
+ *
+ * Usage: mtstress [waves, 300 by default] [threads per wave, 8 by default]
+ * Build with SANITIZER=1 to run it under AddressSanitizer, or with
+ * CFLAGS="-O1 -g -I. -fsanitize=thread" for ThreadSanitizer.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INTERNAL 1
+#include "harness.h"
+
+#define ROUNDS 5000
+#define SLOTS 1024
+#define KEPT 64
+#define MAX_SIZE 128
+
+/* Read by report.c, which would send messages to a web client otherwise */
+int web_connfd = 0;
+
+/* Blocks published by one thread and freed by whichever thread comes next */
+static void *slots[SLOTS];
+static int corrupted;
+
+static uint32_t xorshift(uint32_t *x)
+{
+    *x ^= *x << 13;
+    *x ^= *x >> 17;
+    *x ^= *x << 5;
+    return *x;
+}
+
+static unsigned char fill_byte(const void *p)
+{
+    return (unsigned char) ((uintptr_t) p >> 4);
+}
+
+static void *block_new(size_t size)
+{
+    unsigned char *p = test_malloc(size);
+    if (p) {
+        p[0] = size;
+        memset(p + 1, fill_byte(p), size - 1);
+    }
+    return p;
+}
+
+static void block_free(void *p)
+{
+    const unsigned char *c = p;
+    unsigned char expect = fill_byte(p);
+    for (size_t i = 1; i < c[0]; i++) {
+        if (c[i] != expect) {
+            __atomic_add_fetch(&corrupted, 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    test_free(p);
+}
+
+static void *worker(void *arg)
+{
+    uint32_t x = (uint32_t) (uintptr_t) arg * 2654435761U + 1;
+    void *kept[KEPT];
+    int n = 0;
+
+    for (int i = 0; i < ROUNDS; i++) {
+        size_t size = 1 + xorshift(&x) % MAX_SIZE;
+        void *p = block_new(size);
+        if (!p)
+            continue;
+        if (x & 1) {
+            void *old = __atomic_exchange_n(&slots[(x >> 1) % SLOTS], p,
+                                            __ATOMIC_ACQ_REL);
+            if (old)
+                block_free(old);
+            continue;
+        }
+        if (n == KEPT) {
+            while (n)
+                block_free(kept[--n]);
+        }
+        kept[n++] = p;
+    }
+    while (n)
+        block_free(kept[--n]);
+    return NULL;
+}
+
+static bool run(const char *name, int waves, int threads)
+{
+    pthread_t *tids = malloc(sizeof(pthread_t) * threads);
+    if (!tids)
+        return false;
+
+    for (int w = 0; w < waves; w++) {
+        int started = 0;
+        for (; started < threads; started++) {
+            void *seed = (void *) (uintptr_t) (w * threads + started + 1);
+            if (pthread_create(&tids[started], NULL, worker, seed))
+                break;
+        }
+        for (int i = 0; i < started; i++)
+            pthread_join(tids[i], NULL);
+        if (started < threads) {
+            fprintf(stderr, "Could not create thread %d of wave %d\n",
+                    started, w);
+            free(tids);
+            return false;
+        }
+    }
+    free(tids);
+
+    size_t live = 0;
+    for (int i = 0; i < SLOTS; i++)
+        live += slots[i] != NULL;
+    size_t counted = allocation_check();
+    for (int i = 0; i < SLOTS; i++) {
+        if (slots[i])
+            block_free(slots[i]);
+        slots[i] = NULL;
+    }
+    size_t left = allocation_check();
+    bool errors = error_check();
+
+    bool ok = counted == live && !left && !errors && !corrupted;
+    printf("%-10s %d threads: %zu blocks live, %zu counted, %zu left, %s, "
+           "%d corrupted: %s\n",
+           name, waves * threads, live, counted, left,
+           errors ? "errors" : "no errors", corrupted, ok ? "OK" : "FAILED");
+    corrupted = 0;
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    int waves = argc > 1 ? atoi(argv[1]) : 300;
+    int threads = argc > 2 ? atoi(argv[2]) : 8;
+    if (waves < 1 || threads < 1) {
+        fprintf(stderr, "Usage: %s [waves] [threads per wave]\n", argv[0]);
+        return 1;
+    }
+
+    bool ok = run("default", waves, threads);
+    quarantine_size = SLOTS;
+    ok = run("quarantine", waves, threads) && ok;
+    quarantine_size = 0;
+    arena_mode = 1;
+    ok = run("arena", waves, threads) && ok;
+    arena_mode = 0;
+    return !ok;
+}
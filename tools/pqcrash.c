@@ -0,0 +1,175 @@
+/* Crash-consistency test of the persistent queue of pqueue.c.
+ *
+ * Every round forks a child which opens the queue and runs random inserts at
+ * the tail, removes from the head, reversals and sorts on it, publishing the
+ * number of completed inserts and removes in shared memory. The child is
+ * killed with SIGKILL after a random delay, then the parent opens the queue
+ * again and checks that it holds exactly the strings inserted and not
+ * removed, possibly including the effect of the interrupted operation.
+ *
+ * Usage: pqcrash [file, pqcrash.q by default] [rounds, 200 by default]
+ * Run it on the file system to be tested, such as tmpfs or ext4.
+ */
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pqueue.h"
+
+#define VALUE_FMT "k%09u"
+#define VALUE_LEN 16
+
+typedef struct {
+    volatile uint32_t inserted, removed;
+} progress_t;
+
+static uint64_t xorshift(uint64_t *x)
+{
+    *x ^= *x << 13;
+    *x ^= *x >> 7;
+    *x ^= *x << 17;
+    return *x;
+}
+
+static bool parse(const char *s, uint32_t *v)
+{
+    char *end;
+    if (s[0] != 'k')
+        return false;
+    *v = strtoul(s + 1, &end, 10);
+    return !*end;
+}
+
+/* Put the queue back in ascending order if killed between two reversals */
+static bool restore_order(pqueue_t *q)
+{
+    uint32_t first, last = 0;
+    uint32_t i = pq_first(q);
+    if (!i || !parse(pq_value(q, i), &first))
+        return !i;
+    for (; i; i = pq_next(q, i)) {
+        if (!parse(pq_value(q, i), &last))
+            return false;
+    }
+    if (first > last)
+        pq_reverse(q);
+    return true;
+}
+
+static void child(const char *path, progress_t *p, uint64_t seed)
+{
+    pqueue_t *q = pq_open(path);
+    if (!q || !restore_order(q))
+        _exit(2);
+    pq_set_sync_batch(q, 64);
+
+    char buf[VALUE_LEN], expect[VALUE_LEN];
+    for (;;) {
+        uint64_t r = xorshift(&seed) % 64;
+        if (r < 36) {
+            snprintf(buf, sizeof(buf), VALUE_FMT, p->inserted);
+            if (!pq_insert_tail(q, buf))
+                _exit(3);
+            p->inserted++;
+        } else if (r < 60) {
+            if (!pq_size(q))
+                continue;
+            snprintf(expect, sizeof(expect), VALUE_FMT, p->removed);
+            if (!pq_remove_head(q, buf, sizeof(buf)) || strcmp(buf, expect))
+                _exit(4);
+            p->removed++;
+        } else if (r < 63) {
+            pq_reverse(q);
+            pq_reverse(q);
+        } else {
+            pq_sort(q, true);
+            pq_sort(q, false);
+        }
+    }
+}
+
+/* Check the queue holds the values from removed to inserted, either bound
+ * possibly moved by one by an interrupted operation, and update them.
+ */
+static bool verify(const char *path, progress_t *p, int round)
+{
+    pqueue_t *q = pq_open(path);
+    if (!q) {
+        fprintf(stderr, "round %d: could not open the queue\n", round);
+        return false;
+    }
+
+    bool ok = restore_order(q);
+    uint32_t lo = p->removed, hi = lo, n = 0, v;
+    for (uint32_t i = pq_first(q); ok && i; i = pq_next(q, i), n++) {
+        ok = parse(pq_value(q, i), &v);
+        if (ok && !n) {
+            lo = hi = v;
+            ok = v == p->removed || v == p->removed + 1;
+        }
+        ok = ok && v == hi++;
+    }
+    if (!n)
+        lo = hi = p->inserted;
+    ok = ok && n == pq_size(q) && (hi == p->inserted || hi == p->inserted + 1);
+    if (!ok) {
+        fprintf(stderr,
+                "round %d: queue does not match %u inserts and %u removes\n",
+                round, p->inserted, p->removed);
+    }
+    p->removed = lo;
+    p->inserted = hi;
+    return pq_close(q) && ok;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = argc > 1 ? argv[1] : "pqcrash.q";
+    int rounds = argc > 2 ? atoi(argv[2]) : 200;
+
+    progress_t *p = mmap(NULL, sizeof(progress_t), PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    unlink(path);
+    p->inserted = p->removed = 0;
+
+    uint64_t seed = time(NULL) | 1;
+    printf("Seed %llu\n", (unsigned long long) seed);
+    for (int round = 0; round < rounds; round++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return 1;
+        }
+        if (!pid)
+            child(path, p, xorshift(&seed));
+
+        usleep(1000 + xorshift(&seed) % 20000);
+        kill(pid, SIGKILL);
+        int status;
+        waitpid(pid, &status, 0);
+        if (!WIFSIGNALED(status)) {
+            fprintf(stderr, "round %d: child failed with status %d\n", round,
+                    WEXITSTATUS(status));
+            return 1;
+        }
+        if (!verify(path, p, round))
+            return 1;
+    }
+
+    printf("%d rounds passed, %u elements inserted, %u removed\n", rounds,
+           p->inserted, p->removed);
+    unlink(path);
+    return 0;
+}
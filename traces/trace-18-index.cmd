@@ -0,0 +1,42 @@
+# Test of 'q_get', 'q_insert_at', 'q_delete_at' and 'q_delete_mid' with the order-statistics index
+option fail 0
+option malloc 0
+option index 1
+new
+it a
+it b
+it c
+it d
+it e
+get 0
+get 4
+get 5
+ia x 2
+ia y 0
+ia z 7
+da 0
+da 6
+dm
+get 2
+rh a
+rt e
+sort
+get 1
+reverse
+ia q 1
+da 1
+dm
+dm
+dm
+size
+free
+new
+it RAND 100000
+ia hello 50000
+get 50000
+da 50000
+dm
+reverse
+dm
+size
+free
@@ -0,0 +1,37 @@
+# Test of 'q_insert_sorted', 'q_sort' and 'q_merge' on queues of the sorted kind
+option fail 0
+option malloc 0
+option sorted 1
+new
+is m
+is c
+is x
+is c
+it a
+is d
+sort
+is b
+ih z
+is k
+rh a
+new
+is q
+is a
+is z
+merge
+is n
+free
+new
+is RAND 100000
+sort
+it zzzzzzzzzz
+is aaa
+sort
+free
+option sorted 0
+new
+it z
+it a
+is m
+is b
+free
@@ -0,0 +1,30 @@
+# Test of 'q_delete_dup_unsorted' on unsorted queues
+option fail 0
+option malloc 0
+new
+it b
+it a
+it c
+it a
+it d
+it b
+it e
+it a
+hdedup
+ih e
+it e
+hdedup
+it c
+it d
+hdedup
+free
+new
+it RAND 100000
+it dolphin 1000
+it gerbil
+ih gerbil
+hdedup
+size
+sort
+dedup
+free
@@ -0,0 +1,33 @@
+# Test of string interning across queues
+option fail 0
+option malloc 0
+option intern 1
+new
+it gerbil 3
+ih dolphin 2
+it RAND 5
+ih gerbil
+dedup
+hdedup
+sort
+new
+ih dolphin
+it gerbil 4
+merge
+sort
+dedup
+rh
+it bear 10000
+ih bear 10000
+rt bear
+hdedup
+size
+free
+option intern 0
+new
+it gerbil
+ih gerbil
+it bear
+sort
+dedup
+free
@@ -0,0 +1,82 @@
+# Test of 'q_find' and 'q_remove_value' with a hash index
+option fail 0
+option malloc 0
+option hash 1
+new
+find gerbil
+it gerbil
+ih dolphin
+it bear
+it gerbil
+ih gerbil
+find gerbil
+rv gerbil
+find gerbil
+ia gerbil 1
+find gerbil
+rv bear
+rv bear
+reverse
+find gerbil
+sort
+rv gerbil
+rh dolphin
+it dolphin
+dedup
+find gerbil
+free
+new
+it RAND 1000
+ih gerbil
+it dolphin 50
+it gerbil 50
+ih dolphin
+hdedup
+find gerbil
+find dolphin
+it dolphin
+find dolphin
+rv dolphin
+find dolphin
+sort
+new
+it bear 3
+merge
+find bear
+rv bear
+free
+new
+it RAND 100000
+it gerbil 100
+ih gerbil 100
+rv gerbil
+rv gerbil
+find gerbil
+rt gerbil
+rv gerbil
+size
+free
+# Many equal values share one bucket chain
+new
+it dolphin 80000
+find gerbil
+it dolphin 80000
+it gerbil
+rt gerbil
+it gerbil 2
+rv gerbil
+find gerbil
+reverse
+find dolphin
+rv dolphin
+ih dolphin 80000
+size
+free
+option hash 0
+new
+it gerbil
+ih dolphin
+find gerbil
+rv dolphin
+find dolphin
+free
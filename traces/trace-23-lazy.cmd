@@ -0,0 +1,84 @@
+# Test of lazy 'q_reverse' combined with other operations
+option fail 0
+option malloc 0
+option lazy 1
+new
+ih dolphin
+ih bear
+ih gerbil
+reverse
+it meerkat
+ih vulture
+rh vulture
+rt meerkat
+reverse
+reverse
+ih jaguar
+rh jaguar
+rt gerbil
+reverse
+ih dolphin
+it dolphin
+dm
+size
+reverse
+swap
+reverse
+reverseK 2
+reverse
+sort
+reverse
+dedup
+reverse
+ascend
+free
+option index 1
+option hash 1
+new
+it a
+it b
+it c
+it d
+it b
+reverse
+get 0
+get 3
+ia x 0
+ia y 2
+ia z 7
+da 1
+find b
+rv b
+find b
+dm
+reverse
+get 1
+find b
+reverse
+descend
+free
+new
+it c
+it b
+it a
+reverse
+new
+ih f
+ih e
+ih d
+merge
+free
+new
+it RAND 200000
+reverse
+reverse
+reverse
+it gerbil 1000
+ih gerbil 1000
+rh gerbil
+rt gerbil
+rv gerbil
+size
+sort
+reverse
+free
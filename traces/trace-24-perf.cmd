@@ -0,0 +1,34 @@
+# Test of 'q_topk': small queues in both orders with edge values of k, then
+# selecting from 300000 and 1000000 random elements within the time limit
+option fail 0
+option malloc 0
+new
+topk 3
+it gerbil
+it bear
+it dolphin
+it bear
+it meerkat
+it bear
+topk 2
+topk 0
+topk -1
+topk 10
+option descend 1
+topk 2
+option descend 0
+free
+new
+ih RAND 300000
+topk 10
+option descend 1
+topk 1000
+option descend 0
+free
+new
+ih RAND 500000
+ih RAND 500000
+topk 100
+reverse
+topk 1
+free
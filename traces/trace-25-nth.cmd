@@ -0,0 +1,48 @@
+# Test of 'q_nth' quickselect on small, duplicated and large queues
+option fail 0
+option malloc 0
+new
+nth 0
+it gerbil
+nth 0
+nth 1
+it bear
+it dolphin
+it bear
+it meerkat
+it vulture
+it bear
+nth 0
+nth 3
+nth 6
+nth 5
+nth -1
+nth 7
+free
+new
+it bear 10000
+it dolphin 5000
+ih dolphin 5000
+nth 9999
+nth 10000
+nth 19999
+free
+new
+it RAND 200000
+nth 100000
+nth 0
+nth 199999
+sort
+nth 50000
+reverse
+nth 150000
+nth 12345
+free
+option sorted 1
+new
+it RAND 1000
+sort
+nth 500
+is gerbil
+nth 999
+free
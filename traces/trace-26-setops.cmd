@@ -0,0 +1,90 @@
+# Test of 'q_union', 'q_intersect' and 'q_difference' on sorted queues
+option fail 0
+option malloc 0
+new
+it bear
+it dolphin
+it dolphin
+it gerbil
+it vulture
+new
+it dolphin
+it gerbil
+it gerbil
+it meerkat
+prev
+union
+new
+it bear
+it cat
+it gerbil
+it gerbil
+prev
+intersect
+new
+it bear
+prev
+difference
+new
+prev
+union
+new
+prev
+intersect
+free
+option descend 1
+new
+it vulture
+it meerkat
+it gerbil
+it bear
+new
+it zebra
+it meerkat
+it bear
+it bear
+prev
+union
+new
+it meerkat
+it cat
+prev
+difference
+free
+option descend 0
+new
+new
+it gerbil
+prev
+intersect
+free
+option hash 1
+option intern 1
+new
+it bear 20000
+it dolphin 20000
+new
+it dolphin 20000
+it gerbil 20000
+prev
+union
+size
+find gerbil
+free
+option hash 0
+option intern 0
+new
+ih RAND 100000
+sort
+new
+ih RAND 100000
+sort
+prev
+intersect
+new
+ih RAND 100000
+sort
+prev
+union
+size
+free
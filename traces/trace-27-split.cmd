@@ -0,0 +1,61 @@
+# Test of 'q_split' into contiguous and round-robin shares
+option fail 0
+option malloc 0
+new
+it bear
+it cat
+it dolphin
+it gerbil
+it meerkat
+it vulture
+it zebra
+split 3
+size
+next
+size
+next
+size
+next
+split 2 rr
+next
+split 4 rr
+next
+next
+next
+next
+merge
+size
+split 1
+split 5
+free
+free
+free
+free
+free
+option lazy 1
+option hash 1
+new
+it a
+it b
+it c
+it d
+reverse
+split 2
+find c
+find d
+next
+find c
+free
+free
+option lazy 0
+option hash 0
+new
+it RAND 200000
+sort
+split 8
+merge
+size
+split 16 rr
+merge
+size
+free
@@ -0,0 +1,72 @@
+# Test of 'q_compact' along with later inserts, removes and frees
+option fail 0
+option malloc 0
+new
+compact
+ih dolphin
+ih bear
+ih gerbil
+it meerkat
+it bear
+compact
+rh gerbil
+rt bear
+it vulture
+sort
+dedup
+compact
+ih zebra
+compact
+show
+swap
+reverse
+rh vulture
+rh dolphin
+free
+option intern 1
+option hash 1
+new
+it bear 100
+it gerbil 100
+shuffle
+compact
+find gerbil
+rv gerbil
+sort
+it zebra
+compact
+hdedup
+size
+new
+it bear
+it cat
+prev
+sort
+compact
+merge
+size
+free
+option intern 0
+option hash 0
+option lazy 1
+new
+it a
+it b
+it c
+reverse
+compact
+rh c
+it d
+compact
+rt d
+free
+option lazy 0
+new
+ih RAND 200000
+compact
+sort
+compact
+dm
+reverse
+size
+free
@@ -0,0 +1,58 @@
+# Test of 'q_save' and 'q_load' round trips
+option fail 0
+option malloc 0
+new
+save /tmp/qtest.$$.trace-29.q
+load /tmp/qtest.$$.trace-29.q
+it gerbil
+ih bear
+it dolphin
+it meerkat
+save /tmp/qtest.$$.trace-29.q
+new
+load /tmp/qtest.$$.trace-29.q
+rh bear
+rt meerkat
+load /tmp/qtest.$$.trace-29.q
+size
+sort
+dedup
+free
+option lazy 1
+option hash 1
+new
+it a
+it b
+it c
+reverse
+save /tmp/qtest.$$.trace-29.q
+load /tmp/qtest.$$.trace-29.q
+find a
+rv c
+rt a
+free
+option lazy 0
+option hash 0
+option intern 1
+new
+load /tmp/qtest.$$.trace-29.q
+it b
+hdedup
+free
+free
+option intern 0
+new
+ih RAND 200000
+sort
+save /tmp/qtest.$$.trace-29.q
+new
+load /tmp/qtest.$$.trace-29.q
+load /tmp/qtest.$$.trace-29.q
+size
+sort
+dedup
+size
+compact
+prev
+free
+free
@@ -0,0 +1,38 @@
+# Test of external sort of saved files with 'q_sort_file'
+option fail 0
+option malloc 0
+new
+save /tmp/qtest.$$.trace-30.q
+fsort /tmp/qtest.$$.trace-30.q /tmp/qtest.$$.trace-30-sorted.q
+it gerbil
+it bear
+it dolphin
+it bear
+it aardvark
+save /tmp/qtest.$$.trace-30.q
+option sortmem 16
+fsort /tmp/qtest.$$.trace-30.q /tmp/qtest.$$.trace-30-sorted.q
+new
+load /tmp/qtest.$$.trace-30-sorted.q
+rh aardvark
+rh bear
+rh bear
+rt gerbil
+free
+option descend 1
+fsort /tmp/qtest.$$.trace-30.q /tmp/qtest.$$.trace-30-sorted.q
+new
+load /tmp/qtest.$$.trace-30-sorted.q
+rh gerbil
+rt aardvark
+free
+free
+option descend 0
+option sortmem 4096
+new
+ih RAND 50000
+save /tmp/qtest.$$.trace-30.q
+fsort /tmp/qtest.$$.trace-30.q /tmp/qtest.$$.trace-30-sorted.q
+option descend 1
+fsort /tmp/qtest.$$.trace-30.q /tmp/qtest.$$.trace-30-sorted.q
+free
@@ -0,0 +1,21 @@
+# Test of queue operations with sampled and disabled harness poisoning
+option fail 0
+option malloc 0
+option poison 0
+new
+time ih dolphin 1000000
+time it gerbil 1000000
+time reverse
+time sort
+time free
+option poison 7
+new
+ih RAND 1000
+it RAND 1000
+sort
+dedup
+reverse
+rh
+rt
+time free
+option poison 1
@@ -0,0 +1,34 @@
+# Test of queue operations on blocks carved from the arena of the harness
+option fail 0
+option malloc 0
+option arena 1
+new
+ih dolphin
+ih bear
+it gerbil
+it meerkat
+rh bear
+rt meerkat
+reverse
+sort
+option arena 0
+new
+ih RAND 1000
+option arena 1
+it RAND 1000
+sort
+merge
+dedup
+free
+option arena 2
+option hash 1
+new
+ih RAND 300000
+it zebra
+find zebra
+rt zebra
+sort
+reverse
+free
+option hash 0
+option arena 0
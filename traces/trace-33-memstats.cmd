@@ -0,0 +1,20 @@
+# Test of the allocation profile, with blocks dropped by an arena reset
+option arena 1
+new
+ih dolphin 1000
+it gerbil 200
+memstats reset
+sort
+memstats
+new
+ih meerkat 500
+merge
+memstats
+free
+memstats
+option arena 0
+new
+ih bear 100
+rh bear
+memstats reset
+free
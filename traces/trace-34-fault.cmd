@@ -0,0 +1,24 @@
+# Test of operations with malloc failing on schedules
+option fail 60
+new
+option failevery 3
+ih gerbil 20
+it lion 20
+option failevery 0
+option failfrom 5
+option failto 12
+ih dolphin 10
+reverse
+sort
+option failfrom 0
+option seed 7
+option malloc 50
+it meerkat 20
+option malloc 0
+new
+option malloc 25
+ih bear 10
+option malloc 0
+merge
+size
+free
@@ -0,0 +1,20 @@
+# Test of operations with freed blocks kept poisoned in quarantine
+option quarantine 1000
+new
+ih dolphin 2000
+it gerbil 2000
+rh dolphin
+rt gerbil
+swap
+reverseK 3
+sort
+dm
+new
+ih bear 500
+merge
+option quarantine 10
+free
+new
+ih meerkat 100
+option quarantine 0
+free
@@ -0,0 +1,14 @@
+# Test of operations under a time limit of a fraction of a second
+option fail 0
+option malloc 0
+option timelimit 250
+new
+ih dolphin 10000
+it gerbil 10000
+reverse
+sort
+option timelimit 0
+ih RAND 10000
+sort
+option timelimit 1000
+free
@@ -0,0 +1,22 @@
+# Test of operations with strings and nodes followed by guard pages
+option fail 0
+option malloc 0
+option guard 1
+new
+ih dolphin 200
+it gerbil 200
+rh dolphin
+rt gerbil
+reverse
+sort
+new
+it a_string_long_enough_to_be_guarded_alone
+option guard 32
+it bear 100
+merge
+option quarantine 10
+dm
+swap
+option quarantine 0
+option guard 0
+free
@@ -0,0 +1,29 @@
+# Test of freeing plain queues holding interned strings
+option fail 0
+option malloc 0
+new
+it bear
+it gerbil
+option intern 1
+new
+it bear 2
+it dolphin 3
+merge
+free
+option intern 0
+new
+it bear 2
+it gerbil
+option intern 1
+new
+it meerkat
+prev
+union
+free
+new
+it dolphin 4
+it gerbil 4
+option intern 0
+split 2
+free
+free